@@ -0,0 +1,66 @@
+#include "tensor.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+const size_t DIM_IN = 3;
+const size_t DIM_OUT = 1;
+
+const size_t CLIENTS = 32;
+const size_t REQUESTS_PER_CLIENT = 2000;
+
+void benchmark(size_t maxBatch, std::chrono::microseconds maxLatency);
+
+int main() {
+    // Set seed for reproducibility
+    Tensor::seed(42);
+
+    // Without batching every row runs model on its own. Clients wait for
+    // their answers, so batch bigger than number of clients never fills and
+    // waits for its deadline.
+    benchmark(1, std::chrono::microseconds(0));
+    benchmark(CLIENTS / 2, std::chrono::microseconds(100));
+    benchmark(CLIENTS, std::chrono::microseconds(500));
+}
+
+void benchmark(size_t maxBatch, std::chrono::microseconds maxLatency) {
+    Tensor W({DIM_IN, DIM_OUT}, true);
+    Tensor b({1}, true);
+    InferenceServer server([](std::vector<Tensor>& params, Tensor& x) {
+        return x.mulmat(params[0]) + params[1];
+    }, {&W, &b}, DIM_IN, maxBatch, maxLatency);
+
+    // Every client sends one row and waits for the answer before sending
+    // next one
+    std::vector<std::vector<double>> latencies(CLIENTS);
+    auto client = [&](size_t index) {
+        Tensor row({1, DIM_IN});
+        latencies[index].reserve(REQUESTS_PER_CLIENT);
+        for (size_t i = 0; i < REQUESTS_PER_CLIENT; i++) {
+            const auto start = std::chrono::steady_clock::now();
+            Tensor y = server.infer(row).get();
+            const auto end = std::chrono::steady_clock::now();
+            latencies[index].push_back(std::chrono::duration<double, std::micro>(end - start).count());
+        }
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < CLIENTS; i++)
+        clients.emplace_back(client, i);
+    for (std::thread& thread : clients)
+        thread.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> all;
+    for (const auto& clientLatencies : latencies)
+        all.insert(all.end(), clientLatencies.begin(), clientLatencies.end());
+    std::sort(all.begin(), all.end());
+
+    std::cout << "maxBatch: " << maxBatch << ", maxLatency: " << maxLatency.count() << " us"
+        << ", p50: " << all[all.size() / 2] << " us"
+        << ", p99: " << all[all.size() * 99 / 100] << " us"
+        << ", throughput: " << all.size() / seconds << " req/s" << std::endl;
+}
@@ -62,31 +62,27 @@ int main() {
 
 void normalizeTensor(const std::vector<HouseData>& refrence, Tensor& X, Tensor& y) {
     size_t rowSize = DIM_OUT + DIM_IN;
-    for (size_t i = 0; i < rowSize; i++) {
-        size_t * refPtr = (size_t*) &(refrence[0]);
-        double min = *(refPtr + i);
-        double max = *(refPtr + i);
-
-        // Find max and min
-        for (size_t j = 1; j < refrence.size(); j++) {
-            size_t * refPtr = (size_t*) &(refrence[j]);
-            double val = *(refPtr + i);
-
-            if (val > max) {
-                max = val;
-            } else if (val < min) {
-                min = val;
-            }
-        }
 
-        if (i >= rowSize - DIM_OUT) {
-            for (size_t j = 0; j < y.getShape()[0]; j++)
-                y[y.getShape()[1] * j + i - DIM_IN] = (y[y.getShape()[1] * j + i - DIM_IN] - min) / (max - min);
-        } else {
-            for (size_t j = 0; j < X.getShape()[0]; j++)
-                X[X.getShape()[1] * j + i] = (X[X.getShape()[1] * j + i] - min) / (max - min);
-        }
+    // Put reference data into tensor, one row per house
+    Tensor ref({refrence.size(), rowSize}, 0.0);
+    for (size_t j = 0; j < refrence.size(); j++) {
+        ref[rowSize * j + 0] = refrence[j].size;
+        ref[rowSize * j + 1] = refrence[j].city;
+        ref[rowSize * j + 2] = refrence[j].state;
+        ref[rowSize * j + 3] = refrence[j].price;
     }
+
+    // Find max and min of every column
+    Tensor min = ref.min(0);
+    Tensor max = ref.max(0);
+
+    for (size_t j = 0; j < X.getShape()[0]; j++)
+        for (size_t i = 0; i < DIM_IN; i++)
+            X[DIM_IN * j + i] = (X[DIM_IN * j + i] - min[i]) / (max[i] - min[i]);
+
+    for (size_t j = 0; j < y.getShape()[0]; j++)
+        for (size_t i = 0; i < DIM_OUT; i++)
+            y[DIM_OUT * j + i] = (y[DIM_OUT * j + i] - min[DIM_IN + i]) / (max[DIM_IN + i] - min[DIM_IN + i]);
 }
 
 std::vector<Tensor> getTensorData(std::vector<HouseData>& data) {
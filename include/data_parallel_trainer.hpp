@@ -0,0 +1,98 @@
+#ifndef DATA_PARALLEL_TRAINER_HPP
+#define DATA_PARALLEL_TRAINER_HPP
+
+#include "tensor.hpp"
+#include <barrier>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Trains model with SGD on several threads. Every mini-batch is split by rows
+ * between workers, each worker has its own replica of parameters (sharing
+ * data with them), runs forward and backward on its part and gradients are
+ * summed with tree all-reduce before the parameters are updated.
+ */
+class DataParallelTrainer {
+public:
+    /**
+     * Computes loss of the model, loss has to be mean over rows of the batch
+     * @param params Parameters (replicas) in the same order as given to trainer
+     * @param x Input rows
+     * @param y Expected output rows
+     * @return Loss tensor with one element
+     */
+    using LossFunction = std::function<Tensor(std::vector<Tensor>& params, Tensor& x, Tensor& y)>;
+
+private:
+    struct Worker {
+        std::vector<Tensor> params;
+        double loss;
+        // Exception thrown by loss function or backward in the current step
+        std::exception_ptr error;
+    };
+
+    std::vector<Tensor*> params;
+    LossFunction lossFunction;
+    std::vector<Worker> workers;
+    std::vector<std::thread> threads;
+    std::barrier<> barrier;
+
+    // Current step, worker threads wait for next generation
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t generation;
+    bool stop;
+    const Tensor * x;
+    const Tensor * y;
+    double learningRate;
+
+public:
+    /**
+     * Constructor for DataParallelTrainer, starts worker threads
+     * @param params Parameters of the model, they are updated in place
+     * @param lossFunction Function computing loss of the model
+     * @param workerCount Number of workers, calling thread is one of them (0 for number of cores)
+     */
+    DataParallelTrainer(const std::vector<Tensor*>& params, LossFunction lossFunction,
+        size_t workerCount = 0);
+
+    ~DataParallelTrainer();
+
+    DataParallelTrainer(const DataParallelTrainer&) = delete;
+    DataParallelTrainer& operator=(const DataParallelTrainer&) = delete;
+
+    /**
+     * Do one SGD step on the mini-batch
+     * @param x Input rows, first dimension is split between workers
+     * @param y Expected output rows
+     * @param learningRate Learning rate
+     * @return Loss over the whole mini-batch
+     * @throws Exception of any worker, parameters are not updated then
+     */
+    double step(const Tensor& x, const Tensor& y, double learningRate);
+
+    /**
+     * @return Number of workers
+     */
+    size_t getWorkerCount() const;
+
+private:
+    /**
+     * Loop of worker thread, runs one step per generation
+     * @param index Index of the worker
+     */
+    void workerLoop(size_t index);
+
+    /**
+     * Compute gradient of one part of the batch, take part in all-reduce and
+     * update own part of the parameters
+     * @param index Index of the worker
+     */
+    void runWorker(size_t index);
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef DUAL_TENSOR_HPP
+#define DUAL_TENSOR_HPP
+
+#include "tensor.hpp"
+#include <ostream>
+
+/**
+ * Tensor of dual numbers for forward-mode automatic differentiation. Every
+ * value has its tangent (directional derivative) and every operation
+ * computes values and tangents in the same loop, so Jacobian-vector product
+ * is computed together with the result, without graph and closures.
+ */
+class DualTensor {
+private:
+    Tensor value;
+    Tensor tangent;
+
+public:
+    /**
+     * Constructor for DualTensor
+     * @param value Values of the tensor
+     * @param tangent Direction of the derivative, same shape as value
+     * @throws std::invalid_argument if tangent has different shape than value
+     */
+    DualTensor(const Tensor& value, const Tensor& tangent);
+
+    /**
+     * Constructor for DualTensor with zero tangent (constant)
+     * @param value Values of the tensor
+     */
+    explicit DualTensor(const Tensor& value);
+
+    // Elementwise math operations, tensor with one element is broadcast
+    DualTensor operator+(const DualTensor& other) const;
+    DualTensor operator-(const DualTensor& other) const;
+    DualTensor operator*(const DualTensor& other) const;
+    DualTensor operator/(const DualTensor& other) const;
+
+    friend DualTensor operator+(double number, const DualTensor& other);
+    friend DualTensor operator+(const DualTensor& other, double number);
+    friend DualTensor operator-(double number, const DualTensor& other);
+    friend DualTensor operator-(const DualTensor& other, double number);
+    friend DualTensor operator*(double number, const DualTensor& other);
+    friend DualTensor operator*(const DualTensor& other, double number);
+    friend DualTensor operator/(double number, const DualTensor& other);
+    friend DualTensor operator/(const DualTensor& other, double number);
+
+    /**
+     * Computes mulmat over the last two dimensions (dot product for 1D),
+     * batch dimensions are handled as in Tensor::mulmat
+     * @param other Second tensor
+     * @return Result, empty tensor if shapes don't match
+     */
+    DualTensor mulmat(const DualTensor& other) const;
+
+    DualTensor exp() const;
+    DualTensor pow(double n) const;
+    DualTensor relu() const;
+    DualTensor sigmoid() const;
+    DualTensor tanh() const;
+    DualTensor gelu() const;
+
+    // Softmax and its logarithm over the last dimension
+    DualTensor softmax() const;
+    DualTensor logSoftmax() const;
+
+    // Reductions over all values, result has one element
+    DualTensor sum() const;
+    DualTensor mean() const;
+
+    /**
+     * @return Values of the tensor
+     */
+    const Tensor& getValue() const;
+
+    /**
+     * @return Derivatives of the values in the direction of input tangents
+     */
+    const Tensor& getTangent() const;
+
+    const Shape& getShape() const;
+
+    friend std::ostream& operator<<(std::ostream& os, const DualTensor& tensor);
+
+private:
+    /**
+     * Elementwise operation of two tensors
+     * @param a First tensor
+     * @param b Second tensor
+     * @param operation Operation, "+", "-", "*" or "/"
+     * @return Result, empty tensor if shapes don't match
+     */
+    static DualTensor elementwise(const DualTensor& a, const DualTensor& b, char operation);
+
+    /**
+     * Elementwise function of tensor
+     * @param func Function setting value and derivative of one element
+     * @return Result
+     */
+    template <typename Func>
+    DualTensor unary(Func func) const;
+
+    /**
+     * Computes softmax or its logarithm over the last dimension
+     * @param logarithm Compute log-softmax
+     * @return Result
+     */
+    DualTensor softmax(bool logarithm) const;
+};
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef EMBEDDING_HPP
+#define EMBEDDING_HPP
+
+#include "tensor.hpp"
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Table of trainable vectors looked up by integer index. Gradient of the
+ * table is row-sparse, only rows that were looked up since the last
+ * resetGrad are stored and updated.
+ */
+class Embedding {
+private:
+    /**
+     * Gradient of rows touched by one lookup
+     */
+    struct LookupGrad {
+        // Order of the lookup, gradients are merged in this order
+        size_t order;
+        std::vector<size_t> rows;
+        std::vector<double> values;
+    };
+
+    /**
+     * Gradient of touched rows of the table
+     */
+    struct SparseGrad {
+        // Lookups of one table are separate nodes of the graph, parallel
+        // backward can run them at the same time
+        std::mutex mutex;
+        size_t lookups = 0;
+        // Gradients of lookups whose backward finished, not merged yet
+        std::vector<LookupGrad> pending;
+        // Index of row's gradient in values, for every touched row
+        std::unordered_map<size_t, size_t> slots;
+        std::vector<size_t> rows;
+        std::vector<double> values;
+    };
+
+    Tensor weight;
+    size_t dim;
+    std::shared_ptr<SparseGrad> grad;
+
+public:
+    /**
+     * Constructor for Embedding, table is initialized from normal distribution
+     * @param rows Number of vectors in the table
+     * @param dim Size of every vector
+     * @throws std::invalid_argument if dim is 0
+     */
+    Embedding(size_t rows, size_t dim);
+
+    /**
+     * Gather rows of the table
+     * @param indexes Tensor of row indexes, any shape
+     * @return Tensor with shape of indexes and additional last dimension dim,
+     * empty tensor if any index is not a whole number in range [0, rows)
+     */
+    Tensor forward(Tensor& indexes);
+
+    /**
+     * Update touched rows of the table with gradient descent
+     * @param learningRate Learning rate
+     */
+    void update(double learningRate);
+
+    /**
+     * Reset gradient of touched rows, memory for gradient is kept
+     */
+    void resetGrad();
+
+    /**
+     * Every lookup has its own gradient, they are added to the table's
+     * gradient in order of lookups, so it doesn't depend on order of backward
+     * @return Rows that have gradient since the last resetGrad
+     */
+    const std::vector<size_t>& getGradRows() const;
+
+    /**
+     * @return Gradient of rows from getGradRows, dim values per row
+     */
+    const std::vector<double>& getGradValues() const;
+
+    /**
+     * @return Table of vectors with shape [rows, dim]
+     */
+    Tensor& getWeight();
+
+private:
+    /**
+     * Add gradients of finished lookups to gradient of the table, in order of
+     * lookups
+     */
+    void mergeGrad() const;
+};
+
+#endif
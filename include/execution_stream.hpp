@@ -0,0 +1,80 @@
+#ifndef EXECUTION_STREAM_HPP
+#define EXECUTION_STREAM_HPP
+
+#include "tensor.hpp"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+/**
+ * Stream of tensor operations run by its own worker thread. Operation is
+ * queued and a placeholder tensor is returned at once, so host code
+ * (logging, loading data, ...) overlaps with computation. Operations of one
+ * stream run in the order they were queued. Reading placeholder's data or
+ * shape, printing it or using it in an operation waits for the result.
+ * Errors of operations are thrown when the result is read.
+ */
+class ExecutionStream {
+public:
+    using Operation = std::function<Tensor()>;
+
+private:
+    std::deque<std::packaged_task<Tensor()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::condition_variable idle;
+    size_t running;
+    bool stop;
+    std::thread worker;
+
+public:
+    ExecutionStream();
+
+    /**
+     * Destructor for ExecutionStream, queued operations are finished first
+     */
+    ~ExecutionStream();
+
+    ExecutionStream(const ExecutionStream&) = delete;
+    ExecutionStream& operator=(const ExecutionStream&) = delete;
+
+    /**
+     * Queue operation on given tensors. Tensors are passed by value (they
+     * are handles to the same data) and placeholders among them are
+     * resolved on the worker before the operation runs, as in
+     * stream.enqueue([](Tensor& x, Tensor& W) { return x.mulmat(W); }, x, W).
+     * @param func Operation taking tensors by reference
+     * @param tensors Tensors for the operation
+     * @return Placeholder for the result
+     */
+    template <typename Func, typename... Tensors>
+    Tensor enqueue(Func func, Tensors... tensors) {
+        return enqueue(Operation([func, tensors...]() mutable {
+            (tensors.wait(), ...);
+            return func(tensors...);
+        }));
+    }
+
+    /**
+     * Queue operation, tensors captured by it have to be already computed
+     * @param operation Operation returning its result
+     * @return Placeholder for the result
+     */
+    Tensor enqueue(Operation operation);
+
+    /**
+     * Wait until all queued operations are done
+     */
+    void synchronize();
+
+private:
+    /**
+     * Loop of worker thread, it takes all queued operations at once
+     */
+    void workerLoop();
+};
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef HALF_TENSOR_HPP
+#define HALF_TENSOR_HPP
+
+#include "tensor.hpp"
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+/**
+ * Tensor stored in 16-bit floating point format (bfloat16 or float16). It
+ * takes 4 times less memory than Tensor. Values are converted to float when
+ * they are loaded by kernels and all accumulation is done in float.
+ */
+class HalfTensor {
+public:
+    enum class Precision { BFloat16, Float16 };
+
+private:
+    std::shared_ptr<uint16_t[]> data;
+    Shape shape;
+    size_t totalSize;
+    Precision precision;
+
+public:
+    /**
+     * Constructor for HalfTensor, values are rounded to nearest representable
+     * value
+     * @param tensor Tensor to convert
+     * @param precision Format of stored values
+     */
+    HalfTensor(const Tensor& tensor, Precision precision);
+
+    /**
+     * Constructor for HalfTensor
+     * @param shape Defines shape (dimensions) of the new tensor
+     * @param defaultValue Value that tensor's elements will be initialized with
+     * @param precision Format of stored values
+     */
+    HalfTensor(const Shape& shape, double defaultValue, Precision precision);
+
+    /**
+     * @return Tensor with converted values
+     */
+    Tensor toTensor() const;
+
+    /**
+     * Computes mulmat of 2D tensors, accumulated in float
+     * @param other Tensor with shape [K, N]
+     * @return Result with precision of this tensor, empty tensor if shapes don't match
+     */
+    HalfTensor mulmat(const HalfTensor& other) const;
+
+    /**
+     * @return Sum of the values, accumulated in float
+     */
+    double sum() const;
+
+    // Elementwise math operations, tensors have to have the same shape
+    HalfTensor operator+(const HalfTensor& other) const;
+    HalfTensor operator-(const HalfTensor& other) const;
+    HalfTensor operator*(const HalfTensor& other) const;
+
+    double operator[](size_t index) const;
+
+    /**
+     * Returns shape of the tensor
+     * @return Shape
+     */
+    const Shape& getShape() const;
+
+    /**
+     * @return Format of stored values
+     */
+    Precision getPrecision() const;
+
+    friend std::ostream& operator<<(std::ostream& os, const HalfTensor& tensor);
+
+    /**
+     * Convert float to 16-bit format, rounds to nearest even
+     * @param value Value to convert
+     * @param precision Target format
+     * @return Bits of the 16-bit value
+     */
+    static uint16_t fromFloat(float value, Precision precision);
+
+    /**
+     * Convert 16-bit value to float, conversion is exact
+     * @param bits Bits of the 16-bit value
+     * @param precision Format of the value
+     * @return Converted value
+     */
+    static float toFloat(uint16_t bits, Precision precision);
+
+    /**
+     * @param precision Format of values
+     * @return Max finite value of the format
+     */
+    static double maxValue(Precision precision);
+
+private:
+    /**
+     * Perform elementwise operation, values are computed in float
+     * @param other Second tensor
+     * @param operation Operation, "+", "-" or "*"
+     * @return Result with precision of this tensor, empty tensor if shapes don't match
+     */
+    HalfTensor elementwise(const HalfTensor& other, char operation) const;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef HOGWILD_TRAINER_HPP
+#define HOGWILD_TRAINER_HPP
+
+#include "tensor.hpp"
+#include <functional>
+#include <vector>
+
+/**
+ * Trains model with asynchronous SGD (Hogwild). Every thread takes next
+ * mini-batch, copies shared parameters to its own replicas with relaxed
+ * atomic loads, computes gradient on the replicas and updates shared
+ * parameters with relaxed atomic additions, without any locks or barriers.
+ * Snapshot can mix values from different updates, it works well for sparse
+ * and convex models. Every mini-batch still copies all parameters and scans
+ * all their gradients, so a step costs time proportional to number of
+ * parameters, only writes are limited to values with gradient.
+ */
+class HogwildTrainer {
+public:
+    /**
+     * Computes loss of the model
+     * @param params Parameters (replicas) in the same order as given to trainer
+     * @param x Input rows
+     * @param y Expected output rows
+     * @return Loss tensor with one element
+     */
+    using LossFunction = std::function<Tensor(std::vector<Tensor>& params, Tensor& x, Tensor& y)>;
+
+private:
+    std::vector<Tensor*> params;
+    LossFunction lossFunction;
+    size_t workerCount;
+
+public:
+    /**
+     * Constructor for HogwildTrainer
+     * @param params Parameters of the model, they are updated in place
+     * @param lossFunction Function computing loss of the model
+     * @param workerCount Number of threads (0 for number of cores)
+     */
+    HogwildTrainer(const std::vector<Tensor*>& params, LossFunction lossFunction,
+        size_t workerCount = 0);
+
+    /**
+     * Train on the data, mini-batches are handed out to threads in order
+     * @param x Input rows
+     * @param y Expected output rows
+     * @param batchSize Number of rows in mini-batch
+     * @param epochs Number of passes over the data
+     * @param learningRate Learning rate
+     * @return Mean loss of mini-batches in the last epoch
+     * @throws std::invalid_argument if batchSize is 0
+     * @throws Exception of any worker, it's rethrown after all workers stopped
+     */
+    double train(const Tensor& x, const Tensor& y, size_t batchSize, size_t epochs,
+        double learningRate);
+};
+
+#endif
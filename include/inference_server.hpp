@@ -0,0 +1,88 @@
+#ifndef INFERENCE_SERVER_HPP
+#define INFERENCE_SERVER_HPP
+
+#include "tensor.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Serves model to many threads with dynamic batching. Single rows sent by
+ * callers are collected into one batch until it is full or the oldest row
+ * waits for maxLatency, then the model runs once on the whole batch without
+ * gradient and every caller gets its row of the result.
+ */
+class InferenceServer {
+public:
+    /**
+     * Computes output of the model
+     * @param params Parameters of the model (without gradient) in the same order as given to server
+     * @param x Batch of input rows
+     * @return Batch of output rows
+     */
+    using Model = std::function<Tensor(std::vector<Tensor>& params, Tensor& x)>;
+
+private:
+    struct Request {
+        Tensor row;
+        std::chrono::steady_clock::time_point arrival;
+        std::promise<Tensor> result;
+    };
+
+    Model model;
+    std::vector<Tensor> params;
+    size_t inputSize;
+    size_t maxBatch;
+    std::chrono::microseconds maxLatency;
+
+    std::vector<Request> requests;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    bool stop;
+    std::thread worker;
+
+public:
+    /**
+     * Constructor for InferenceServer
+     * @param model Function computing output of the model
+     * @param params Parameters of the model, server shares their data
+     * @param inputSize Number of values in one input row
+     * @param maxBatch Maximal number of rows in one batch
+     * @param maxLatency Maximal time the oldest row waits for other rows
+     */
+    InferenceServer(Model model, const std::vector<Tensor*>& params, size_t inputSize,
+        size_t maxBatch, std::chrono::microseconds maxLatency);
+
+    /**
+     * Destructor for InferenceServer, queued rows are answered first
+     */
+    ~InferenceServer();
+
+    InferenceServer(const InferenceServer&) = delete;
+    InferenceServer& operator=(const InferenceServer&) = delete;
+
+    /**
+     * Queue one input row, it can be called from any thread
+     * @param row Input row with inputSize values
+     * @return Future output row of shape [1, ...], empty tensor if row has wrong size
+     */
+    std::future<Tensor> infer(const Tensor& row);
+
+private:
+    /**
+     * Loop of batching thread
+     */
+    void workerLoop();
+
+    /**
+     * Run model on the batch and send results to callers
+     * @param batch Requests in the batch
+     */
+    void runBatch(std::vector<Request>& batch);
+};
+
+#endif
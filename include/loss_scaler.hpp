@@ -0,0 +1,63 @@
+#ifndef LOSS_SCALER_HPP
+#define LOSS_SCALER_HPP
+
+#include "tensor.hpp"
+#include "half_tensor.hpp"
+#include <vector>
+
+/**
+ * Dynamic loss scaling for training with reduced precision gradients. Loss is
+ * multiplied by the scale before backward, scaled gradients are stored in
+ * 16-bit format, so small gradients don't underflow. If any scaled gradient
+ * overflows the format, step is skipped and scale is halved, after a number
+ * of successful steps scale is doubled.
+ */
+class LossScaler {
+private:
+    double scale;
+    size_t growthInterval;
+    size_t goodSteps;
+    HalfTensor::Precision precision;
+    // Scaled gradients in 16-bit format from the last call of unscale
+    std::vector<HalfTensor> grads;
+
+public:
+    /**
+     * Constructor for LossScaler
+     * @param precision Format gradients are stored in
+     * @param initialScale Initial loss scale
+     * @param growthInterval Number of steps without overflow before scale is doubled
+     */
+    LossScaler(HalfTensor::Precision precision, double initialScale = 65536.0,
+        size_t growthInterval = 2000);
+
+    /**
+     * Multiply loss by current scale, call backward on the result
+     * @param loss Loss tensor
+     * @return Scaled loss
+     */
+    Tensor scaleLoss(Tensor& loss) const;
+
+    /**
+     * Store scaled gradients of parameters in 16-bit format and check them for
+     * overflow. Gradients of parameters are replaced by the stored values
+     * divided by the scale, so update uses what 16-bit gradients hold. On
+     * overflow gradients are left unchanged and scale is halved.
+     * @param params Parameters of the model
+     * @return true if parameters should be updated, false if step has to be skipped
+     */
+    bool unscale(const std::vector<Tensor*>& params);
+
+    /**
+     * @return Scaled 16-bit gradients from the last call of unscale, in order
+     * of parameters (parameters without gradient are skipped)
+     */
+    const std::vector<HalfTensor>& getGrads() const;
+
+    /**
+     * @return Current loss scale
+     */
+    double getScale() const;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef PROCESS_GROUP_HPP
+#define PROCESS_GROUP_HPP
+
+#include "tensor.hpp"
+#include <string>
+#include <vector>
+
+/**
+ * Group of local processes training one model with data parallelism.
+ * Gradients are exchanged through POSIX shared memory, processes are
+ * synchronized over Unix domain sockets (rank 0 accepts connections of the
+ * others). All processes have to call the same methods in the same order.
+ */
+class ProcessGroup {
+private:
+    std::string name;
+    size_t rank;
+    size_t size;
+    size_t capacity;
+
+    // Shared memory: one slot per process and one slot for results, every
+    // slot has capacity doubles
+    double * shared;
+    size_t sharedBytes;
+
+    int listenSocket;
+    // Rank 0 has socket for every other process (index rank - 1), others
+    // have only socket to rank 0
+    std::vector<int> sockets;
+
+public:
+    /**
+     * Constructor for ProcessGroup, waits for all processes to join
+     * @param name Name of the group, used for shared memory and socket path
+     * @param rank Index of this process
+     * @param size Number of processes
+     * @param capacity Max number of values in all parameters of the model
+     */
+    ProcessGroup(const std::string& name, size_t rank, size_t size, size_t capacity);
+
+    ~ProcessGroup();
+
+    ProcessGroup(const ProcessGroup&) = delete;
+    ProcessGroup& operator=(const ProcessGroup&) = delete;
+
+    /**
+     * Average gradients of parameters over all processes, parameters without
+     * gradient are skipped
+     * @param params Parameters of the model
+     */
+    void allReduce(const std::vector<Tensor*>& params);
+
+    /**
+     * Do backward propagation from loss and average gradients of parameters
+     * over all processes. Parameters are exchanged as soon as their gradient
+     * is complete, while the rest of the graph is still processed.
+     * Parameters without gradient are skipped. If backward throws, gradients
+     * are still exchanged, so other processes don't wait forever.
+     * @param loss Loss of this process
+     * @param params Parameters of the model, put parameters used last first
+     */
+    void backward(Tensor& loss, const std::vector<Tensor*>& params);
+
+    /**
+     * Copy parameter values of rank 0 to all processes
+     * @param params Parameters of the model
+     */
+    void broadcast(const std::vector<Tensor*>& params);
+
+    /**
+     * Wait until all processes call barrier
+     */
+    void barrier();
+
+    size_t getRank() const;
+    size_t getSize() const;
+
+private:
+    /**
+     * Average values over all processes, every process sums its own part
+     * @param values Values of this process, replaced by average
+     * @param offset Position of the values in shared slots
+     * @param count Number of values
+     */
+    void reduce(double * values, size_t offset, size_t count);
+
+    /**
+     * @param params Parameters of the model
+     * @return Position of every parameter in shared slots
+     */
+    std::vector<size_t> getOffsets(const std::vector<Tensor*>& params) const;
+
+    /**
+     * Unmap shared memory and close sockets
+     */
+    void release();
+};
+
+#endif
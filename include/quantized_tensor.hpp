@@ -0,0 +1,60 @@
+#ifndef QUANTIZED_TENSOR_HPP
+#define QUANTIZED_TENSOR_HPP
+
+#include "tensor.hpp"
+#include <cstdint>
+#include <memory>
+
+/**
+ * 2D weights quantized to int8 with one scale per output channel (column).
+ * It's used for inference with Tensor::mulmat, weights take 8 times less
+ * memory than double tensor.
+ */
+class QuantizedTensor {
+private:
+    size_t rows;
+    size_t cols;
+    // Rows rounded up to the width of the SIMD kernel, padding is zero
+    size_t paddedRows;
+
+    // Weights are stored transposed [cols, paddedRows], so every output
+    // channel is contiguous
+    std::shared_ptr<int8_t[]> data;
+    std::shared_ptr<float[]> scales;
+    // Sum of quantized weights of every column, used to correct unsigned
+    // activations
+    std::shared_ptr<int32_t[]> sums;
+
+public:
+    /**
+     * Quantize weights, every column gets symmetric scale max(|column|) / 127
+     * @param weight 2D tensor with shape [K, N], dimensions after the first one are columns
+     */
+    QuantizedTensor(const Tensor& weight);
+
+    /**
+     * @return Weights converted back to double tensor
+     */
+    Tensor dequantize() const;
+
+    /**
+     * Returns shape of the tensor
+     * @return Shape
+     */
+    Shape getShape() const;
+
+    friend class Tensor;
+
+private:
+    /**
+     * Dot product of unsigned and signed 8-bit arrays, uses VNNI instructions
+     * when they are available
+     * @param a Unsigned array
+     * @param b Signed array
+     * @param size Number of elements, multiple of 64
+     * @return Dot product
+     */
+    static int32_t dotKernel(const uint8_t * a, const int8_t * b, size_t size);
+};
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef SPARSE_TENSOR_HPP
+#define SPARSE_TENSOR_HPP
+
+#include "tensor.hpp"
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+/**
+ * Sparse 2D tensor stored in CSR (compressed sparse row) format. Only non
+ * zero elements are stored, so operations cost time proportional to number
+ * of non zero elements. Sparse tensor itself doesn't track gradient, it is
+ * meant for inputs like one-hot encoded features.
+ */
+class SparseTensor {
+private:
+    size_t rows;
+    size_t cols;
+
+    // Non zero elements of row i are in range [rowOffsets[i], rowOffsets[i + 1])
+    std::shared_ptr<std::vector<size_t>> rowOffsets;
+    std::shared_ptr<std::vector<size_t>> colIndexes;
+    std::shared_ptr<std::vector<double>> values;
+
+    // Transposed tensor (CSC of this tensor) used in backward, created on
+    // first use. Copies share it, so it is created once for all of them.
+    struct Transposed {
+        std::once_flag created;
+        std::shared_ptr<const SparseTensor> tensor;
+    };
+    std::shared_ptr<Transposed> transposed;
+
+public:
+    /**
+     * Constructor for SparseTensor from elements in COO (coordinate) format.
+     * Elements can be in any order, duplicates are summed.
+     * @param rows Number of rows
+     * @param cols Number of columns
+     * @param rowIndexes Row of every element
+     * @param colIndexes Column of every element
+     * @param values Value of every element
+     */
+    SparseTensor(size_t rows, size_t cols, const std::vector<size_t>& rowIndexes,
+        const std::vector<size_t>& colIndexes, const std::vector<double>& values);
+
+    /**
+     * Create sparse tensor from 2D tensor, zero elements are skipped
+     * @param dense 2D tensor, dimensions after the first one are columns
+     * @return Sparse tensor
+     */
+    static SparseTensor fromDense(const Tensor& dense);
+
+    /**
+     * Computes mulmat of sparse and dense 2D tensor. Gradient is tracked for
+     * the dense tensor.
+     * @param other Dense tensor with shape [cols, n]
+     * @return Dense result with shape [rows, n], empty tensor if shapes don't match
+     */
+    Tensor mulmat(Tensor& other) const;
+
+    /**
+     * @return Dense copy of the tensor
+     */
+    Tensor toDense() const;
+
+    /**
+     * @return Number of stored (non zero) elements
+     */
+    size_t nonZeros() const;
+
+    /**
+     * Returns shape of the tensor
+     * @return Shape
+     */
+    Shape getShape() const;
+
+    friend std::ostream& operator<<(std::ostream& os, const SparseTensor& tensor);
+
+private:
+    /**
+     * @return Transposed tensor, it's created on the first call, calls from
+     * more threads are safe
+     */
+    std::shared_ptr<const SparseTensor> getTransposed() const;
+
+    /**
+     * Multiply sparse matrix by dense matrix, result is added to res
+     * @param sparse Sparse matrix
+     * @param dense Data of dense matrix with n columns
+     * @param res Data of result with n columns
+     * @param n Number of columns of dense matrix
+     */
+    static void mulmatKernel(const SparseTensor& sparse, const double * dense, double * res,
+        size_t n);
+};
+
+#endif
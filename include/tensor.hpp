@@ -1,7 +1,10 @@
 #ifndef TENSOR_HPP
 #define TENSOR_HPP
 
+#include <array>
+#include <atomic>
 #include <cstdint>
+#include <initializer_list>
 #include <ostream>
 #include <random>
 #include <iostream>
@@ -10,37 +13,116 @@
 #include <vector>
 #include <ostream>
 #include <functional>
+#include <future>
+
+/**
+ * Shape (or strides) of a tensor. Dimensions are stored inline with fixed
+ * capacity, so creating or copying a shape doesn't allocate memory.
+ */
+class Shape {
+public:
+    static constexpr size_t MAX_DIMS = 8;
+
+    Shape();
+
+    /**
+     * Constructor for Shape
+     * @param dims Dimensions of the shape, at most MAX_DIMS
+     */
+    Shape(std::initializer_list<size_t> dims);
+
+    /**
+     * Constructor for Shape
+     * @param dims Dimensions of the shape, at most MAX_DIMS
+     */
+    Shape(const std::vector<size_t>& dims);
+
+    /**
+     * @return Number of dimensions
+     */
+    size_t size() const;
+
+    size_t operator[](size_t index) const;
+    size_t& operator[](size_t index);
+    bool operator==(const Shape& other) const;
+    operator std::vector<size_t>() const;
+
+    /**
+     * @return Last dimension
+     */
+    size_t back() const;
+
+    const size_t * begin() const;
+    const size_t * end() const;
+
+private:
+    std::array<size_t, MAX_DIMS> dims;
+    size_t rank;
+};
+
+class QuantizedTensor;
 
 class Tensor {
 private:
+    // Nodes of the graph are identified by their storage, copies of one
+    // tensor are the same node
     struct HashFunction {
-        // Calculate hash from tensor
         size_t operator()(const Tensor& tensor) const {
-            size_t dataHash = 0;
-            for (size_t i = 0; i < tensor.totalSize; i++) {
-                dataHash ^= std::hash<double>()(tensor.data[i]);
-            }
-            size_t shapeHash = 0;
-            for (size_t i = 0; i < tensor.shape.size(); i++) {
-                shapeHash ^= std::hash<size_t>()(tensor.shape[i]);
-            }
-
-            return dataHash ^ shapeHash;
+            return std::hash<const void*>()(tensor.data.get())
+                ^ (std::hash<const void*>()(tensor.grad.get()) << 1);
+        }
+    };
+
+    struct EqualFunction {
+        bool operator()(const Tensor& a, const Tensor& b) const {
+            return a.data == b.data && a.grad == b.grad;
         }
     };
 
     std::shared_ptr<double[]> data;
-    std::vector<size_t> shape;
+    Shape shape;
+    // Number of elements to skip in data to move by one in each dimension
+    Shape strides;
     size_t totalSize;
 
     bool requiresGrad;
     bool isGradInit;
     mutable std::shared_ptr<std::function<void()>> _backward;
-    mutable std::unordered_set<Tensor, HashFunction> prev;
+    mutable std::unordered_set<Tensor, HashFunction, EqualFunction> prev;
     mutable std::string operation;
 
-    static inline std::mt19937 gen;
-    static inline std::uniform_real_distribution<double> dis{0.0, 1.0};
+    // Result of operation queued to ExecutionStream, the tensor is a
+    // placeholder until it is computed. Result in the future is never
+    // changed, so const methods read it from there.
+    std::shared_ptr<std::shared_future<Tensor>> pending;
+
+    // State of counter based random generator. Every random tensor reserves
+    // its own range of counters, so it can be filled in any order.
+    static inline uint64_t rngSeed = 0;
+    static inline std::atomic<uint64_t> rngOffset{0};
+
+    enum class Distribution { Uniform, Normal };
+    enum class Reduction { Sum, Mean, Max, Min, ArgMax, ArgMin };
+    enum class Activation { ReLU, Sigmoid, Tanh, GELU };
+
+    // Reductions are computed in fixed order, independent of number of threads
+    static inline bool deterministic = true;
+
+    // Set on threads that already run in parallel with others, their
+    // operations are not split between more threads
+    static inline thread_local bool singleThreaded = false;
+
+    friend class SparseTensor;
+    friend class Embedding;
+    friend class QuantizedTensor;
+    friend class HalfTensor;
+    friend class LossScaler;
+    friend class DataParallelTrainer;
+    friend class ProcessGroup;
+    friend class HogwildTrainer;
+    friend class DualTensor;
+    friend class ExecutionStream;
+    friend class InferenceServer;
 
 public:
     mutable std::shared_ptr<Tensor> grad;
@@ -50,7 +132,7 @@ public:
      * @param shape Defines shape (dimensions) of the new tensor
      * @param defaultValue Value that tensor's elements will be initialized with
      */
-    Tensor(const std::vector<size_t>& shape, double defaultValue);
+    Tensor(const Shape& shape, double defaultValue);
 
     /**
      * Constructor for Tensor
@@ -58,20 +140,20 @@ public:
      * @param defaultValue Value that tensor's elements will be initialized with
      * @param requiresGrad set if gradient is required for this tensor
      */
-    Tensor(const std::vector<size_t>& shape, double defaultValue, bool requiresGrad);
+    Tensor(const Shape& shape, double defaultValue, bool requiresGrad);
 
     /**
      * Constructor for Tensor. Fills elements with randomly generated values.
      * @param shape Defines shape (dimensions) of the new tensor
      */
-    Tensor(const std::vector<size_t>& shape);
+    Tensor(const Shape& shape);
 
     /**
      * Constructor for Tensor. Fills elements with randomly generated values.
      * @param shape Defines shape (dimensions) of the new tensor
      * @param requiresGrad set if gradient is required for this tensor
      */
-    Tensor(const std::vector<size_t>& shape, bool requiresGrad);
+    Tensor(const Shape& shape, bool requiresGrad);
 
     /**
      * Constructor for Tensor. Fills elements with randomly generated values.
@@ -80,9 +162,9 @@ public:
      * @param operation string operation that was used in creation of this tensor
      * @param children Nodes that this node was created from
      */
-    Tensor(const std::vector<size_t>& shape,
+    Tensor(const Shape& shape,
         bool requiresGrad, const std::string& operation,
-        const std::unordered_set<Tensor, HashFunction>& children);
+        const std::unordered_set<Tensor, HashFunction, EqualFunction>& children);
 
     /**
      * Constructor for Tensor
@@ -92,9 +174,45 @@ public:
      * @param operation string operation that was used in creation of this tensor
      * @param children Nodes that this node was created from
      */
-    Tensor(const std::vector<size_t>& shape, double defaultValue,
+    Tensor(const Shape& shape, double defaultValue,
         bool requiresGrad, const std::string& operation,
-        const std::unordered_set<Tensor, HashFunction>& children);
+        const std::unordered_set<Tensor, HashFunction, EqualFunction>& children);
+
+    /**
+     * Create tensor filled with values from uniform distribution
+     * @param shape Defines shape (dimensions) of the new tensor
+     * @param low Lower bound of generated values
+     * @param high Upper bound of generated values
+     * @param requiresGrad set if gradient is required for this tensor
+     */
+    static Tensor uniform(const Shape& shape, double low, double high,
+        bool requiresGrad = false);
+
+    /**
+     * Create tensor filled with values from normal distribution
+     * @param shape Defines shape (dimensions) of the new tensor
+     * @param mean Mean of generated values
+     * @param stddev Standard deviation of generated values
+     * @param requiresGrad set if gradient is required for this tensor
+     */
+    static Tensor normal(const Shape& shape, double mean, double stddev,
+        bool requiresGrad = false);
+
+    /**
+     * Create tensor with Xavier (Glorot) uniform initialization. Last two
+     * dimensions are treated as [fanIn, fanOut], as in x.mulmat(W).
+     * @param shape Defines shape (dimensions) of the new tensor
+     * @param requiresGrad set if gradient is required for this tensor
+     */
+    static Tensor xavier(const Shape& shape, bool requiresGrad = false);
+
+    /**
+     * Create tensor with He (Kaiming) normal initialization. Second to last
+     * dimension is treated as fanIn, as in x.mulmat(W).
+     * @param shape Defines shape (dimensions) of the new tensor
+     * @param requiresGrad set if gradient is required for this tensor
+     */
+    static Tensor he(const Shape& shape, bool requiresGrad = false);
 
     /**
      * Do backward propagation from this node to all its children nodes.
@@ -103,7 +221,16 @@ public:
     void backward();
 
     /**
-     * Reset variables that are used to calculate grad
+     * Do backward propagation, report leaf tensors as soon as their gradient
+     * is complete, rest of the graph can still be processed
+     * @param onGradReady Called with every leaf tensor once nothing else adds
+     * to its gradient, it can be called from threads of the pool
+     */
+    void backward(const std::function<void(const Tensor&)>& onGradReady);
+
+    /**
+     * Reset variables that are used to calculate grad. Already allocated
+     * gradient storage is kept and only zeroed out.
      */
     void resetGrad();
 
@@ -121,17 +248,118 @@ public:
     bool operator==(const Tensor& other) const;
 
     /**
-     * Computes mulmat operation at tensors
+     * Computes mulmat operation at tensors. Leading dimensions are batch
+     * dimensions and have to be the same, except that one matrix (2D tensor
+     * or batch dimensions of size 1) is shared by every matrix of the other
+     * one, so K stacked models can be evaluated at once, as in x.mulmat(W)
+     * with x of shape [N, fanIn] and W of shape [K, fanIn, fanOut]. Result
+     * has batch dimensions of the batched tensor, or of the one with higher
+     * rank if both are single matrices.
      * @param other Second tensor for mulmat operation
-     * @return Result of mulmat as tensor
+     * @return Result of mulmat as tensor, empty tensor if shapes don't match
      */
     Tensor mulmat(Tensor& other);
 
+    /**
+     * Computes mulmat with int8 quantized weights, this tensor is quantized
+     * dynamically (per row). Used for inference, gradient is not tracked.
+     * @param other Quantized weights with shape [K, N]
+     * @return Result with shape of this tensor with last dimension N, empty
+     * tensor if shapes don't match
+     */
+    Tensor mulmat(const QuantizedTensor& other) const;
+
+    /**
+     * Computes dot product of two tensors with the same number of elements
+     * @param other Second tensor for dot product
+     * @return Result of dot product as scalar tensor
+     */
+    Tensor dot(Tensor& other);
+
     /**
      * Computes exp operation on tensor
      */
     Tensor exp();
 
+    /**
+     * Computes ReLU activation, max(0, x)
+     */
+    Tensor relu();
+
+    /**
+     * Computes sigmoid activation, 1 / (1 + exp(-x))
+     */
+    Tensor sigmoid();
+
+    /**
+     * Computes tanh activation
+     */
+    Tensor tanh();
+
+    /**
+     * Computes GELU activation (tanh approximation)
+     */
+    Tensor gelu();
+
+    /**
+     * Computes softmax over the last dimension. Max of every row is
+     * subtracted before exponentiation, so the result doesn't overflow.
+     * Empty tensor gives empty tensor.
+     */
+    Tensor softmax();
+
+    /**
+     * Computes logarithm of softmax over the last dimension, numerically
+     * stable. Empty tensor gives empty tensor.
+     */
+    Tensor logSoftmax();
+
+    /**
+     * Computes mean cross entropy loss of logits and class labels
+     * @param logits Tensor of unnormalized scores, classes are in the last dimension
+     * @param labels Tensor with class index for every row of logits
+     * @return Loss as scalar tensor, empty tensor if logits are empty, number of
+     * labels doesn't match or a label is not a class index in range [0, classes)
+     */
+    static Tensor crossEntropy(Tensor& logits, Tensor& labels);
+
+    /**
+     * Computes 2D convolution of NCHW tensor
+     * @param weight Filters with shape [outChannels, inChannels, kernelHeight, kernelWidth]
+     * @param stride Step of the filters
+     * @param padding Number of zeros added to every side of the input
+     * @return Result with shape [N, outChannels, outHeight, outWidth], empty
+     * tensor if shapes don't match
+     */
+    Tensor conv2d(Tensor& weight, size_t stride = 1, size_t padding = 0);
+
+    /**
+     * Computes 2D convolution of NCHW tensor
+     * @param weight Filters with shape [outChannels, inChannels, kernelHeight, kernelWidth]
+     * @param bias Bias with shape [outChannels]
+     * @param stride Step of the filters
+     * @param padding Number of zeros added to every side of the input
+     * @return Result with shape [N, outChannels, outHeight, outWidth], empty
+     * tensor if shapes don't match
+     */
+    Tensor conv2d(Tensor& weight, Tensor& bias, size_t stride = 1, size_t padding = 0);
+
+    /**
+     * Computes 2D max pooling of NCHW tensor
+     * @param kernel Size of the pooling window
+     * @param stride Step of the pooling window
+     * @return Result with shape [N, C, outHeight, outWidth]
+     */
+    Tensor maxPool2d(size_t kernel, size_t stride);
+
+    /**
+     * Computes 2D average pooling of NCHW tensor
+     * @param kernel Size of the pooling window
+     * @param stride Step of the pooling window
+     * @return Result with shape [N, C, outHeight, outWidth]
+     */
+    Tensor avgPool2d(size_t kernel, size_t stride);
+
     /**
      * Raises tensor to the power of n
      * @param n Exponent
@@ -144,12 +372,12 @@ public:
     Tensor mean();
 
     /**
-     * @return Max value from Tensor
+     * @return Max value from Tensor, empty tensor if Tensor has no values
      */
     Tensor max();
 
     /**
-     * @return Min value from Tensor
+     * @return Min value from Tensor, empty tensor if Tensor has no values
      */
     Tensor min();
 
@@ -158,6 +386,48 @@ public:
      */
     Tensor sum();
 
+    /**
+     * @param axis Dimension to reduce
+     * @param keepdim Keep reduced dimension with size 1
+     * @return Sums of Tensor's values along axis, zeros if axis is empty
+     */
+    Tensor sum(size_t axis, bool keepdim = false);
+
+    /**
+     * @param axis Dimension to reduce
+     * @param keepdim Keep reduced dimension with size 1
+     * @return Means of Tensor's values along axis, empty tensor if axis is empty
+     */
+    Tensor mean(size_t axis, bool keepdim = false);
+
+    /**
+     * @param axis Dimension to reduce
+     * @param keepdim Keep reduced dimension with size 1
+     * @return Max values along axis, empty tensor if axis is empty
+     */
+    Tensor max(size_t axis, bool keepdim = false);
+
+    /**
+     * @param axis Dimension to reduce
+     * @param keepdim Keep reduced dimension with size 1
+     * @return Min values along axis, empty tensor if axis is empty
+     */
+    Tensor min(size_t axis, bool keepdim = false);
+
+    /**
+     * @param axis Dimension to reduce
+     * @param keepdim Keep reduced dimension with size 1
+     * @return Indexes of max values along axis (without gradient), empty tensor if axis is empty
+     */
+    Tensor argmax(size_t axis, bool keepdim = false);
+
+    /**
+     * @param axis Dimension to reduce
+     * @param keepdim Keep reduced dimension with size 1
+     * @return Indexes of min values along axis (without gradient), empty tensor if axis is empty
+     */
+    Tensor argmin(size_t axis, bool keepdim = false);
+
     // Math operations with numbers
     friend Tensor operator+(double number, Tensor& other);
     friend Tensor operator+(Tensor& other, double number);
@@ -170,22 +440,140 @@ public:
 
     /**
      * Define seed for random generation. This seed will be used for every new
-     * Tensor with randomly generated values.
+     * Tensor with randomly generated values. Generated values don't depend
+     * on number of threads used to fill the tensors.
      * @param Seed for random generation
      */
     static void seed(uint64_t seed);
 
     /**
-     * Returns shape of the tensor
+     * Set if reductions (sum, mean, ...) have to return bit-identical results
+     * no matter how many threads are used. Enabled by default, disabling it
+     * lets threads combine their partial results in any order.
+     * @param deterministic Enable deterministic reductions
+     */
+    static void setDeterministic(bool deterministic);
+
+    // Placement of memory of large tensors on NUMA machines
+    enum class MemoryPolicy { FirstTouch, Interleave, Bind };
+
+    /**
+     * Set where memory of new large tensors is placed. FirstTouch puts every
+     * page to the node of the thread which initializes it (initialization is
+     * split between threads of the pool, later operations can split the
+     * tensor differently), Interleave spreads pages over all nodes and Bind
+     * puts them to one node.
+     * @param policy Memory policy
+     * @param node Node used by Bind policy
+     * @throws std::invalid_argument if Bind node is not online
+     */
+    static void setMemoryPolicy(MemoryPolicy policy, unsigned node = 0);
+
+    // Backing of memory of large tensors by huge pages
+    enum class HugePages { None, Transparent, Explicit };
+
+    /**
+     * Set if memory of new large tensors is backed by huge pages, to lower
+     * TLB misses. Transparent asks kernel for huge pages with madvise,
+     * Explicit maps reserved huge pages (MAP_HUGETLB) and falls back to
+     * Transparent if there are none.
+     * @param mode Use of huge pages
+     */
+    static void setHugePages(HugePages mode);
+
+    /**
+     * Returns shape of the tensor, placeholder waits for its result
      * @return Shape
      */
-    const std::vector<size_t>& getShape() const;
+    const Shape& getShape() const;
+
+    /**
+     * Wait until placeholder returned by ExecutionStream is computed and
+     * take over its result, nothing is done for other tensors. Operations,
+     * indexing, printing and getShape wait on their own.
+     * @return This tensor
+     */
+    Tensor& wait();
 
 private:
+    static inline MemoryPolicy memoryPolicy = MemoryPolicy::FirstTouch;
+    static inline unsigned memoryNode = 0;
+    static inline HugePages hugePages = HugePages::None;
+
+    /**
+     * Allocate uninitialized memory for tensor's data, aligned to cache line.
+     * Large buffers are mapped directly, placed by memory policy and can be
+     * backed by huge pages.
+     * @param size Number of values
+     * @return Pointer owning the memory
+     * @throws std::runtime_error if kernel refuses the memory policy
+     */
+    static std::shared_ptr<double[]> allocate(size_t size);
+
+    /**
+     * Fill tensor's data with random values. Values are generated by Philox
+     * counter based generator, so data can be split between threads.
+     * @param distribution Distribution of generated values
+     * @param a Lower bound for uniform distribution, mean for normal distribution
+     * @param b Upper bound for uniform distribution, standard deviation for normal distribution
+     */
+    void fillRandom(Distribution distribution, double a, double b);
+
+    /**
+     * Split range [0, size) into chunks and process them on the global
+     * thread pool. Small ranges are processed on calling thread.
+     * @param size Size of the range
+     * @param func Function processing chunk [begin, end)
+     * @param minChunk Minimal number of iterations worth of own thread
+     */
+    static void parallelFor(size_t size, const std::function<void(size_t, size_t)>& func,
+        size_t minChunk = 1 << 15);
+
+    /**
+     * Get fan in and fan out of the tensor, used for weights initialization
+     * @param shape Shape of the weights
+     * @return Pair of fan in and fan out
+     */
+    static std::pair<double, double> getFans(const Shape& shape);
+
+    /**
+     * Calculate totalSize and strides from shape
+     */
+    void initStrides();
+
+    /**
+     * Run backward functions of the graph on the global thread pool. Node
+     * runs once all nodes using it are done, nodes adding to the same
+     * gradient run in the same order as in serial backward, so results are
+     * the same. If a node throws, the remaining nodes are skipped and the
+     * first exception is rethrown once no task uses the graph.
+     * @param topo Nodes of the graph sorted so children are before parents
+     * @param onGradReady Called with every leaf tensor once its gradient is complete
+     */
+    static void backwardParallel(const std::vector<const Tensor*>& topo,
+        const std::function<void(const Tensor&)>& onGradReady);
+
+    /**
+     * Wait for result of placeholder without changing it
+     * @return Result of placeholder, this tensor for other tensors
+     */
+    const Tensor& resolved() const;
+
+    /**
+     * Create leaf tensor sharing data with this tensor, it has its own
+     * gradient and no graph history
+     * @return Tensor using the same data
+     */
+    Tensor replica() const;
+
     /**
-     * @return Random number between 0 and 1
+     * Create leaf tensor without gradient sharing rows [begin, end) of the
+     * first dimension with this tensor
+     * @param begin First row
+     * @param end Row after the last one
+     * @return Tensor using part of the data
      */
-    static double getRandomNumber();
+    Tensor rowsView(size_t begin, size_t end) const;
 
     /**
      * Recursively travel through Tensors dimensions, and print its data to os
@@ -238,22 +626,129 @@ private:
     static Tensor tensorsOperations(double number, Tensor& a, std::string operation);
 
     /**
-     * Recursively calculates mulmat on tensors, and saves result to the res.
-     * @param other Other tensor for calculation
-     * @param res Result tensor
-     * @param shapeIndexes Indicates which data in batch dimensions were already processed
-     * (in manual call resize to the this->shape.size())
-     * @param dim Current dimension (in manual call set to 0)
+     * Calculate matrix multiplication for every matrix in batch dimensions
+     * @param a Data of the first tensor
+     * @param b Data of the second tensor
+     * @param res Data of the result, it has to be zeroed
+     * @param batches Number of matrices in batch dimensions
+     * @param rows Number of rows of the first tensor's matrices
+     * @param cols Number of columns of the first tensor's matrices
+     * @param otherCols Number of columns of the second tensor's matrices
+     * @param sharedA True if the first tensor is one matrix used for every batch
+     */
+    static void mulmatKernel(const double * a, const double * b, double * res,
+        size_t batches, size_t rows, size_t cols, size_t otherCols, bool sharedA = false);
+
+    /**
+     * Calculate gradients of mulmat for every matrix in batch dimensions
+     * @param a Data of the first tensor
+     * @param b Data of the second tensor
+     * @param g Gradient of the result
+     * @param aGrad Gradient of the first tensor, nullptr if not needed
+     * @param bGrad Gradient of the second tensor, nullptr if not needed
+     * @param batches Number of matrices in batch dimensions
+     * @param rows Number of rows of the first tensor's matrices
+     * @param cols Number of columns of the first tensor's matrices
+     * @param otherCols Number of columns of the second tensor's matrices
+     * @param sharedA True if the first tensor is one matrix used for every batch
+     */
+    static void mulmatBackwardKernel(const double * a, const double * b, const double * g,
+        double * aGrad, double * bGrad, size_t batches, size_t rows, size_t cols,
+        size_t otherCols, bool sharedA = false);
+
+    /**
+     * Calculate matrix-vector product, result is added to res
+     * @param a Data of the matrix
+     * @param x Data of the vector
+     * @param res Data of the result
+     * @param rows Number of rows of the matrix
+     * @param cols Number of columns of the matrix
+     */
+    static void gemvKernel(const double * a, const double * x, double * res,
+        size_t rows, size_t cols);
+
+    /**
+     * Calculate gradients of matrix-vector product
+     * @param a Data of the matrix
+     * @param x Data of the vector
+     * @param g Gradient of the result
+     * @param aGrad Gradient of the matrix, nullptr if not needed
+     * @param xGrad Gradient of the vector, nullptr if not needed
+     * @param rows Number of rows of the matrix
+     * @param cols Number of columns of the matrix
+     */
+    static void gemvBackwardKernel(const double * a, const double * x, const double * g,
+        double * aGrad, double * xGrad, size_t rows, size_t cols);
+
+    /**
+     * Apply activation function on every element of the tensor. Backward
+     * derives gradient from the saved output where possible.
+     * @param activation Type of the activation
+     * @return Result tensor
+     */
+    Tensor activate(Activation activation);
+
+    /**
+     * Computes softmax or its logarithm over the last dimension
+     * @param logarithm Return logarithm of softmax if true
+     * @return Result tensor
+     */
+    Tensor softmax(bool logarithm);
+
+    /**
+     * Computes 2D convolution, lowered to matrix multiplication of filters
+     * and tiles of unfolded input (im2col)
+     * @param weight Filters with shape [outChannels, inChannels, kernelHeight, kernelWidth]
+     * @param bias Bias with shape [outChannels], nullptr if not used
+     * @param stride Step of the filters
+     * @param padding Number of zeros added to every side of the input
+     * @return Result tensor
+     */
+    Tensor conv2d(Tensor& weight, Tensor * bias, size_t stride, size_t padding);
+
+    /**
+     * Computes 2D max or average pooling
+     * @param kernel Size of the pooling window
+     * @param stride Step of the pooling window
+     * @param isMax Compute max pooling if true, average pooling otherwise
+     * @return Result tensor
+     */
+    Tensor pool2d(size_t kernel, size_t stride, bool isMax);
+
+    /**
+     * Reduce tensor along one axis
+     * @param axis Dimension to reduce
+     * @param keepdim Keep reduced dimension with size 1
+     * @param reduction Type of the reduction
+     * @return Reduced tensor, empty tensor if axis is out of range
+     */
+    Tensor reduceAxis(size_t axis, bool keepdim, Reduction reduction);
+
+    /**
+     * Calculate sum of an array, in parallel with pairwise summation
+     * @param data Array to sum
+     * @param size Number of elements in array
+     * @return Sum of the array
+     */
+    static double sumKernel(const double * data, size_t size);
+
+    /**
+     * Find index of max (or min) value in an array, in parallel
+     * @param data Array to search, it can't be empty
+     * @param size Number of elements in array
+     * @param findMax Find max value if true, min value otherwise
+     * @return Index of the first max (or min) value
      */
-    void mulmat(Tensor& other, Tensor& res,
-        std::vector<size_t>& shapeIndexes, size_t dim);
+    static size_t extremumKernel(const double * data, size_t size, bool findMax);
 
     /**
-     * Calculate offset for t.data, based on already processed indexes (shapeIndexes)
-     * @param shapeIndexes Indicates which data in batch dimensions were already processed
-     * @param t Processed tensor
+     * Calculate dot product of two arrays
+     * @param a First array
+     * @param b Second array
+     * @param size Number of elements in arrays
+     * @return Dot product
      */
-    static size_t getMemoryOffset(std::vector<size_t> shapeIndexes, const Tensor& t);
+    static double dotKernel(const double * a, const double * b, size_t size);
 };
 
 #endif
@@ -0,0 +1,125 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Pool of threads with work stealing. Every worker has its own queue, it
+ * runs its newest tasks first and when it has nothing to do, it steals the
+ * oldest tasks of other workers. Threads waiting for tasks help to run them.
+ */
+class ThreadPool {
+public:
+    using Task = std::function<void()>;
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // One queue per worker, the last one is for threads outside the pool
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    std::atomic<size_t> queued;
+    bool stop;
+
+    static inline thread_local ThreadPool * current = nullptr;
+    static inline thread_local size_t currentIndex = 0;
+
+public:
+    /**
+     * Constructor for ThreadPool
+     * @param threadCount Number of worker threads
+     */
+    explicit ThreadPool(size_t threadCount);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Pool shared by the whole library, it has one thread less than there are
+     * cores, because calling thread helps with the work
+     * @return Global pool
+     */
+    static ThreadPool& global();
+
+    /**
+     * Add task to the queue of current worker (or shared queue)
+     * @param task Task to run
+     */
+    void submit(Task task);
+
+    /**
+     * Pin every worker to its own core, in the order of cores the process
+     * can use, starting from the second one. Threads don't move between
+     * cores then, but chunk boundaries of parallelFor depend on size and
+     * grain of every operation, so a part of a tensor isn't always processed
+     * on the node where it was first touched.
+     * @return false if pinning is not supported
+     */
+    bool pinThreads();
+
+    /**
+     * Run tasks until counter drops to zero
+     * @param pending Counter decremented by the tasks
+     */
+    void waitFor(const std::atomic<size_t>& pending);
+
+    /**
+     * Split range [0, size) into chunks and process them in parallel,
+     * calling thread processes the first chunk and others are queued to
+     * workers in turn. Range shorter than two grains is processed on
+     * calling thread. If a chunk throws, the first exception is rethrown
+     * after all chunks are done.
+     * @param size Size of the range
+     * @param func Function processing chunk [begin, end)
+     * @param grain Minimal number of iterations worth of own task
+     */
+    void parallelFor(size_t size, const std::function<void(size_t, size_t)>& func, size_t grain);
+
+    /**
+     * @return Number of worker threads
+     */
+    size_t getThreadCount() const;
+
+private:
+    /**
+     * Add task to the given queue
+     * @param task Task to run
+     * @param index Index of the queue
+     */
+    void submit(Task task, size_t index);
+
+    /**
+     * Loop of worker thread
+     * @param index Index of the worker's queue
+     */
+    void workerLoop(size_t index);
+
+    /**
+     * Run own newest task or steal the oldest task of another queue
+     * @param index Index of own queue
+     * @return false if there was no task
+     */
+    bool runTask(size_t index);
+
+    /**
+     * @return Index of queue of calling thread
+     */
+    size_t ownQueue() const;
+};
+
+#endif
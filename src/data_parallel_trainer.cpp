@@ -0,0 +1,157 @@
+#include "data_parallel_trainer.hpp"
+#include "tensor.hpp"
+#include <algorithm>
+#include <barrier>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+DataParallelTrainer::DataParallelTrainer(const std::vector<Tensor*>& params,
+    LossFunction lossFunction, size_t workerCount)
+    :params(params), lossFunction(lossFunction),
+    workers(workerCount != 0 ? workerCount : std::max(1u, std::thread::hardware_concurrency())),
+    barrier(workers.size()), generation(0), stop(false), x(nullptr), y(nullptr), learningRate(0.0)
+{
+    for (Worker& worker : this->workers) {
+        for (const Tensor * param : this->params)
+            worker.params.push_back(param->replica());
+        worker.loss = 0.0;
+    }
+
+    // Worker 0 is the thread calling step
+    for (size_t i = 1; i < this->workers.size(); i++)
+        this->threads.emplace_back(&DataParallelTrainer::workerLoop, this, i);
+}
+
+DataParallelTrainer::~DataParallelTrainer() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stop = true;
+    }
+    this->condition.notify_all();
+    for (std::thread& thread : this->threads)
+        thread.join();
+}
+
+double DataParallelTrainer::step(const Tensor& x, const Tensor& y, double learningRate) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->x = &x;
+        this->y = &y;
+        this->learningRate = learningRate;
+        this->generation++;
+    }
+    this->condition.notify_all();
+
+    // Last barrier of runWorker waits for all workers
+    runWorker(0);
+
+    for (Worker& worker : this->workers) {
+        if (worker.error != nullptr)
+            std::rethrow_exception(std::exchange(worker.error, nullptr));
+    }
+
+    double loss = 0.0;
+    for (const Worker& worker : this->workers)
+        loss += worker.loss;
+    return loss;
+}
+
+size_t DataParallelTrainer::getWorkerCount() const {
+    return this->workers.size();
+}
+
+void DataParallelTrainer::workerLoop(size_t index) {
+    size_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->condition.wait(lock, [&]() {return this->stop || this->generation != seen;});
+            if (this->stop)
+                return;
+            seen = this->generation;
+        }
+        runWorker(index);
+    }
+}
+
+void DataParallelTrainer::runWorker(size_t index) {
+    const size_t count = this->workers.size();
+    Worker& worker = this->workers[index];
+    const bool wasSingleThreaded = Tensor::singleThreaded;
+    Tensor::singleThreaded = count > 1;
+
+    // Rows of the batch are split evenly, loss of every part is weighted by
+    // its size so the sum is mean over the whole batch
+    const size_t rows = this->x->resolved().shape[0];
+    const size_t begin = rows * index / count;
+    const size_t end = rows * (index + 1) / count;
+    const double weight = (double) (end - begin) / rows;
+
+    for (Tensor& param : worker.params)
+        param.resetGrad();
+    worker.loss = 0.0;
+
+    // Failed worker still takes part in all barriers, so others don't wait
+    // for it forever
+    worker.error = nullptr;
+    if (end > begin) {
+        try {
+            Tensor x = this->x->rowsView(begin, end);
+            Tensor y = this->y->rowsView(begin, end);
+            Tensor loss = this->lossFunction(worker.params, x, y);
+            loss.backward();
+            worker.loss = loss.data[0] * weight;
+
+            for (Tensor& param : worker.params) {
+                if (param.grad == nullptr)
+                    continue;
+                double * grad = param.grad->data.get();
+                for (size_t i = 0; i < param.totalSize; i++)
+                    grad[i] *= weight;
+            }
+        } catch (...) {
+            worker.error = std::current_exception();
+        }
+    }
+
+    // Tree all-reduce, after log2(count) rounds worker 0 has the sum of all
+    // gradients. Parameters share memory, so sum is read by all workers.
+    for (size_t stride = 1; stride < count; stride *= 2) {
+        this->barrier.arrive_and_wait();
+        if (index % (2 * stride) == 0 && index + stride < count) {
+            const Worker& other = this->workers[index + stride];
+            for (size_t p = 0; p < worker.params.size(); p++) {
+                if (worker.params[p].grad == nullptr)
+                    continue;
+                double * grad = worker.params[p].grad->data.get();
+                const double * otherGrad = other.params[p].grad->data.get();
+                for (size_t i = 0; i < worker.params[p].totalSize; i++)
+                    grad[i] += otherGrad[i];
+            }
+        }
+    }
+    this->barrier.arrive_and_wait();
+
+    // Errors are set before the barrier, so all workers skip the update
+    const bool failed = std::any_of(this->workers.begin(), this->workers.end(),
+        [](const Worker& other) { return other.error != nullptr; });
+
+    // Every worker updates its own part of every parameter
+    const std::vector<Tensor>& reduced = this->workers[0].params;
+    for (size_t p = 0; p < reduced.size() && !failed; p++) {
+        if (reduced[p].grad == nullptr)
+            continue;
+        const size_t size = reduced[p].totalSize;
+        double * data = reduced[p].data.get();
+        const double * grad = reduced[p].grad->data.get();
+        for (size_t i = size * index / count; i < size * (index + 1) / count; i++)
+            data[i] -= this->learningRate * grad[i];
+    }
+    this->barrier.arrive_and_wait();
+
+    Tensor::singleThreaded = wasSingleThreaded;
+}
@@ -0,0 +1,302 @@
+#include "dual_tensor.hpp"
+#include "tensor.hpp"
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <ostream>
+#include <stdexcept>
+
+DualTensor::DualTensor(const Tensor& value, const Tensor& tangent)
+    :value(value.resolved()), tangent(tangent.resolved())
+{
+    // Every operation indexes tangent with size of value
+    if (!(value.shape == tangent.shape))
+        throw std::invalid_argument("DualTensor: tangent has different shape than value");
+}
+
+DualTensor::DualTensor(const Tensor& value)
+    :value(value.resolved()), tangent(value.resolved().shape, 0.0)
+{}
+
+template <typename Func>
+DualTensor DualTensor::unary(Func func) const {
+    Tensor value(this->value.shape, 0.0), tangent(this->value.shape, 0.0);
+    const double * x = this->value.data.get(), * dx = this->tangent.data.get();
+    double * res = value.data.get(), * dres = tangent.data.get();
+    Tensor::parallelFor(value.totalSize, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            double derivative = 0.0;
+            res[i] = func(x[i], derivative);
+            dres[i] = derivative * dx[i];
+        }
+    }, 1 << 12);
+
+    return DualTensor(value, tangent);
+}
+
+DualTensor DualTensor::operator+(const DualTensor& other) const {
+    return elementwise(*this, other, '+');
+}
+
+DualTensor DualTensor::operator-(const DualTensor& other) const {
+    return elementwise(*this, other, '-');
+}
+
+DualTensor DualTensor::operator*(const DualTensor& other) const {
+    return elementwise(*this, other, '*');
+}
+
+DualTensor DualTensor::operator/(const DualTensor& other) const {
+    return elementwise(*this, other, '/');
+}
+
+DualTensor operator+(double number, const DualTensor& other) {
+    return other.unary([=](double x, double& derivative) {derivative = 1.0; return number + x;});
+}
+
+DualTensor operator+(const DualTensor& other, double number) {
+    return number + other;
+}
+
+DualTensor operator-(double number, const DualTensor& other) {
+    return other.unary([=](double x, double& derivative) {derivative = -1.0; return number - x;});
+}
+
+DualTensor operator-(const DualTensor& other, double number) {
+    return other.unary([=](double x, double& derivative) {derivative = 1.0; return x - number;});
+}
+
+DualTensor operator*(double number, const DualTensor& other) {
+    return other.unary([=](double x, double& derivative) {derivative = number; return number * x;});
+}
+
+DualTensor operator*(const DualTensor& other, double number) {
+    return number * other;
+}
+
+DualTensor operator/(double number, const DualTensor& other) {
+    return other.unary([=](double x, double& derivative) {
+        derivative = -number / (x * x);
+        return number / x;
+    });
+}
+
+DualTensor operator/(const DualTensor& other, double number) {
+    return other.unary([=](double x, double& derivative) {derivative = 1.0 / number; return x / number;});
+}
+
+DualTensor DualTensor::elementwise(const DualTensor& a, const DualTensor& b, char operation) {
+    const size_t aSize = a.value.totalSize, bSize = b.value.totalSize;
+    if (!(a.value.shape == b.value.shape) && aSize != 1 && bSize != 1)
+        return DualTensor(Tensor({0}, 0.0));
+
+    // Tensor with one element is broadcast over the other one
+    const Shape& shape = aSize == 1 ? b.value.shape : a.value.shape;
+    Tensor value(shape, 0.0), tangent(shape, 0.0);
+    const size_t size = value.totalSize;
+    const size_t aStep = aSize == size ? 1 : 0;
+    const size_t bStep = bSize == size ? 1 : 0;
+
+    const double * x = a.value.data.get(), * dx = a.tangent.data.get();
+    const double * y = b.value.data.get(), * dy = b.tangent.data.get();
+    double * res = value.data.get(), * dres = tangent.data.get();
+    Tensor::parallelFor(size, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const double u = x[i * aStep], du = dx[i * aStep];
+            const double v = y[i * bStep], dv = dy[i * bStep];
+            switch (operation) {
+                case '+': res[i] = u + v; dres[i] = du + dv; break;
+                case '-': res[i] = u - v; dres[i] = du - dv; break;
+                case '*': res[i] = u * v; dres[i] = du * v + u * dv; break;
+                default: res[i] = u / v; dres[i] = (du * v - u * dv) / (v * v); break;
+            }
+        }
+    });
+
+    return DualTensor(value, tangent);
+}
+
+DualTensor DualTensor::mulmat(const DualTensor& other) const {
+    const Shape& aShape = this->value.shape, & bShape = other.value.shape;
+    const size_t rank = aShape.size(), otherRank = bShape.size();
+    if (rank == 0 || otherRank == 0)
+        return DualTensor(Tensor({0}, 0.0));
+
+    // Dot product: d(a.b) = da.b + a.db
+    if (rank == 1 && otherRank == 1) {
+        if (aShape[0] != bShape[0])
+            return DualTensor(Tensor({0}, 0.0));
+        const size_t size = aShape[0];
+        Tensor value({1}, 0.0), tangent({1}, 0.0);
+        value.data[0] = Tensor::dotKernel(this->value.data.get(), other.value.data.get(), size);
+        tangent.data[0] = Tensor::dotKernel(this->tangent.data.get(), other.value.data.get(), size)
+            + Tensor::dotKernel(this->value.data.get(), other.tangent.data.get(), size);
+        return DualTensor(value, tangent);
+    }
+
+    // Shapes are checked and batches are laid out the same way as in
+    // Tensor::mulmat, one matrix can be shared by every batch of the other
+    if (rank == 1 || otherRank == 1 || aShape[rank - 1] != bShape[otherRank - 2])
+        return DualTensor(Tensor({0}, 0.0));
+    size_t aBatches = 1, bBatches = 1;
+    for (size_t i = 0; i + 2 < rank; i++)
+        aBatches *= aShape[i];
+    for (size_t i = 0; i + 2 < otherRank; i++)
+        bBatches *= bShape[i];
+    const bool sameBatches = rank == otherRank
+        && std::equal(aShape.begin(), aShape.end() - 2, bShape.begin());
+    if (!sameBatches && aBatches != 1 && bBatches != 1)
+        return DualTensor(Tensor({0}, 0.0));
+    const bool sharedA = !sameBatches && aBatches == 1;
+    const bool sharedB = !sameBatches && !sharedA;
+
+    const bool batchedB = bBatches != 1 || (aBatches == 1 && otherRank > rank);
+    Shape resShape = batchedB ? bShape : aShape;
+    resShape[resShape.size() - 2] = aShape[rank - 2];
+    resShape[resShape.size() - 1] = bShape[otherRank - 1];
+
+    const size_t cols = aShape[rank - 1];
+    const size_t otherCols = bShape[otherRank - 1];
+    const size_t rows = aShape[rank - 2] * (sharedB ? aBatches : 1);
+    const size_t batches = sharedA ? bBatches : sharedB ? 1 : aBatches;
+
+    // d(AB) = dA B + A dB, kernels add to the result, so both products are
+    // accumulated in the same tangent
+    Tensor value(resShape, 0.0), tangent(resShape, 0.0);
+    Tensor::mulmatKernel(this->value.data.get(), other.value.data.get(), value.data.get(),
+        batches, rows, cols, otherCols, sharedA);
+    Tensor::mulmatKernel(this->tangent.data.get(), other.value.data.get(), tangent.data.get(),
+        batches, rows, cols, otherCols, sharedA);
+    Tensor::mulmatKernel(this->value.data.get(), other.tangent.data.get(), tangent.data.get(),
+        batches, rows, cols, otherCols, sharedA);
+
+    return DualTensor(value, tangent);
+}
+
+DualTensor DualTensor::exp() const {
+    return unary([](double x, double& derivative) {
+        const double y = std::exp(x);
+        derivative = y;
+        return y;
+    });
+}
+
+DualTensor DualTensor::pow(double n) const {
+    return unary([=](double x, double& derivative) {
+        derivative = n * std::pow(x, n - 1);
+        return std::pow(x, n);
+    });
+}
+
+DualTensor DualTensor::relu() const {
+    return unary([](double x, double& derivative) {
+        derivative = x > 0.0 ? 1.0 : 0.0;
+        return x > 0.0 ? x : 0.0;
+    });
+}
+
+DualTensor DualTensor::sigmoid() const {
+    return unary([](double x, double& derivative) {
+        const double y = 1.0 / (1.0 + std::exp(-x));
+        derivative = y * (1.0 - y);
+        return y;
+    });
+}
+
+DualTensor DualTensor::tanh() const {
+    return unary([](double x, double& derivative) {
+        const double y = std::tanh(x);
+        derivative = 1.0 - y * y;
+        return y;
+    });
+}
+
+DualTensor DualTensor::gelu() const {
+    // Same tanh approximation as Tensor::gelu
+    const double geluScale = std::sqrt(2.0 / std::numbers::pi);
+    const double geluCubic = 0.044715;
+    return unary([=](double x, double& derivative) {
+        const double t = std::tanh(geluScale * (x + geluCubic * x * x * x));
+        const double dt = geluScale * (1.0 + 3.0 * geluCubic * x * x);
+        derivative = 0.5 * (1.0 + t) + 0.5 * x * (1.0 - t * t) * dt;
+        return 0.5 * x * (1.0 + t);
+    });
+}
+
+DualTensor DualTensor::softmax() const {
+    return softmax(false);
+}
+
+DualTensor DualTensor::logSoftmax() const {
+    return softmax(true);
+}
+
+DualTensor DualTensor::softmax(bool logarithm) const {
+    if (this->value.shape.size() == 0 || this->value.totalSize == 0)
+        return DualTensor(Tensor({0}, 0.0));
+
+    const size_t cols = this->value.shape.back();
+    const size_t rows = this->value.totalSize / cols;
+    Tensor value(this->value.shape, 0.0), tangent(this->value.shape, 0.0);
+    const double * x = this->value.data.get(), * dx = this->tangent.data.get();
+    double * res = value.data.get(), * dres = tangent.data.get();
+
+    // Row by row: d(softmax) = s * (dx - sum(s * dx)), d(log-softmax) = dx - sum(s * dx)
+    Tensor::parallelFor(rows, [=](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            const double * in = x + r * cols, * din = dx + r * cols;
+            double * out = res + r * cols, * dout = dres + r * cols;
+
+            const double max = *std::max_element(in, in + cols);
+            double sum = 0.0;
+            for (size_t j = 0; j < cols; j++) {
+                out[j] = std::exp(in[j] - max);
+                sum += out[j];
+            }
+            double weighted = 0.0;
+            for (size_t j = 0; j < cols; j++) {
+                out[j] /= sum;
+                weighted += out[j] * din[j];
+            }
+
+            const double logSum = std::log(sum);
+            for (size_t j = 0; j < cols; j++) {
+                if (logarithm) {
+                    dout[j] = din[j] - weighted;
+                    out[j] = in[j] - max - logSum;
+                } else {
+                    dout[j] = out[j] * (din[j] - weighted);
+                }
+            }
+        }
+    }, (1 << 12) / cols + 1);
+
+    return DualTensor(value, tangent);
+}
+
+DualTensor DualTensor::sum() const {
+    Tensor value({1}, 0.0), tangent({1}, 0.0);
+    value.data[0] = Tensor::sumKernel(this->value.data.get(), this->value.totalSize);
+    tangent.data[0] = Tensor::sumKernel(this->tangent.data.get(), this->tangent.totalSize);
+    return DualTensor(value, tangent);
+}
+
+DualTensor DualTensor::mean() const {
+    return sum() / (double) this->value.totalSize;
+}
+
+const Tensor& DualTensor::getValue() const {
+    return this->value;
+}
+
+const Tensor& DualTensor::getTangent() const {
+    return this->tangent;
+}
+
+const Shape& DualTensor::getShape() const {
+    return this->value.shape;
+}
+
+std::ostream& operator<<(std::ostream& os, const DualTensor& tensor) {
+    return os << "value: " << tensor.value << "tangent: " << tensor.tangent;
+}
@@ -0,0 +1,152 @@
+#include "embedding.hpp"
+#include "tensor.hpp"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+Embedding::Embedding(size_t rows, size_t dim)
+    :weight(Tensor::normal({rows, dim}, 0.0, 1.0)), dim(dim)
+{
+    if (dim == 0)
+        throw std::invalid_argument("Embedding dimension has to be positive");
+    this->grad = std::make_shared<SparseGrad>();
+}
+
+namespace {
+/**
+ * @param index Index as stored in tensor
+ * @param rows Number of rows of the table
+ * @return true if index is a whole number in range [0, rows)
+ */
+bool isValidRow(double index, size_t rows) {
+    return index >= 0.0 && index < (double) rows && index == std::floor(index);
+}
+}
+
+Tensor Embedding::forward(Tensor& indexes) {
+    indexes.wait();
+    const size_t rows = this->weight.shape[0];
+    const double * index = indexes.data.get();
+    for (size_t i = 0; i < indexes.totalSize; i++) {
+        if (!isValidRow(index[i], rows))
+            return Tensor({0}, 0.0);
+    }
+
+    std::vector<size_t> resDims(indexes.shape.begin(), indexes.shape.end());
+    resDims.push_back(this->dim);
+
+    // Result is leaf of the graph, its backward writes to sparse gradient
+    Tensor result(resDims, 0.0, true);
+
+    // Gather rows of the table
+    const double * table = this->weight.data.get();
+    double * out = result.data.get();
+    const size_t dim = this->dim;
+    Tensor::parallelFor(indexes.totalSize, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const size_t row = (size_t) index[i];
+            std::copy_n(table + row * dim, dim, out + i * dim);
+        }
+    }, (1 << 15) / dim + 1);
+
+    // Scatter gradient to rows touched by this lookup, it is merged with
+    // other lookups later
+    size_t order;
+    {
+        std::lock_guard<std::mutex> lock(this->grad->mutex);
+        order = this->grad->lookups++;
+    }
+    std::shared_ptr<double[]> indexData = indexes.data;
+    std::shared_ptr<SparseGrad> grad = this->grad;
+    std::shared_ptr<Tensor> resGrad = result.grad;
+    const size_t count = indexes.totalSize;
+    result._backward = std::make_shared<std::function<void()>>(
+        [indexData, grad, resGrad, order, count, rows, dim]() {
+            LookupGrad lookup{order, {}, {}};
+            std::unordered_map<size_t, size_t> slots;
+            for (size_t i = 0; i < count; i++) {
+                // Indexes could be changed since forward
+                if (!isValidRow(indexData[i], rows))
+                    continue;
+                const size_t row = (size_t) indexData[i];
+                auto [slot, isNew] = slots.try_emplace(row, lookup.rows.size());
+                if (isNew) {
+                    lookup.rows.push_back(row);
+                    lookup.values.resize(lookup.values.size() + dim, 0.0);
+                }
+
+                double * rowGrad = lookup.values.data() + slot->second * dim;
+                const double * g = resGrad->data.get() + i * dim;
+                for (size_t j = 0; j < dim; j++)
+                    rowGrad[j] += g[j];
+            }
+
+            std::lock_guard<std::mutex> lock(grad->mutex);
+            grad->pending.push_back(std::move(lookup));
+        });
+
+    return result;
+}
+
+void Embedding::mergeGrad() const {
+    std::lock_guard<std::mutex> lock(this->grad->mutex);
+    std::vector<LookupGrad>& pending = this->grad->pending;
+    std::sort(pending.begin(), pending.end(),
+        [](const LookupGrad& a, const LookupGrad& b) { return a.order < b.order; });
+
+    for (const LookupGrad& lookup : pending) {
+        for (size_t i = 0; i < lookup.rows.size(); i++) {
+            auto [slot, isNew] = this->grad->slots.try_emplace(lookup.rows[i],
+                this->grad->rows.size());
+            if (isNew) {
+                this->grad->rows.push_back(lookup.rows[i]);
+                this->grad->values.resize(this->grad->values.size() + this->dim, 0.0);
+            }
+
+            double * rowGrad = this->grad->values.data() + slot->second * this->dim;
+            const double * g = lookup.values.data() + i * this->dim;
+            for (size_t j = 0; j < this->dim; j++)
+                rowGrad[j] += g[j];
+        }
+    }
+    pending.clear();
+}
+
+void Embedding::update(double learningRate) {
+    mergeGrad();
+    double * table = this->weight.data.get();
+    for (size_t slot = 0; slot < this->grad->rows.size(); slot++) {
+        double * row = table + this->grad->rows[slot] * this->dim;
+        const double * rowGrad = this->grad->values.data() + slot * this->dim;
+        for (size_t j = 0; j < this->dim; j++)
+            row[j] -= learningRate * rowGrad[j];
+    }
+}
+
+void Embedding::resetGrad() {
+    // Vectors keep their capacity, so steady training doesn't allocate
+    std::lock_guard<std::mutex> lock(this->grad->mutex);
+    this->grad->pending.clear();
+    this->grad->slots.clear();
+    this->grad->rows.clear();
+    this->grad->values.clear();
+}
+
+const std::vector<size_t>& Embedding::getGradRows() const {
+    mergeGrad();
+    return this->grad->rows;
+}
+
+const std::vector<double>& Embedding::getGradValues() const {
+    mergeGrad();
+    return this->grad->values;
+}
+
+Tensor& Embedding::getWeight() {
+    return this->weight;
+}
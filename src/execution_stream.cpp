@@ -0,0 +1,60 @@
+#include "execution_stream.hpp"
+#include "tensor.hpp"
+#include <memory>
+#include <utility>
+
+ExecutionStream::ExecutionStream()
+    :running(0), stop(false)
+{
+    this->worker = std::thread([this]() { workerLoop(); });
+}
+
+ExecutionStream::~ExecutionStream() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stop = true;
+    }
+    this->wakeUp.notify_one();
+    this->worker.join();
+}
+
+Tensor ExecutionStream::enqueue(Operation operation) {
+    std::packaged_task<Tensor()> task(std::move(operation));
+    Tensor placeholder({0}, 0.0);
+    placeholder.pending = std::make_shared<std::shared_future<Tensor>>(task.get_future().share());
+
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->tasks.push_back(std::move(task));
+    }
+    this->wakeUp.notify_one();
+    return placeholder;
+}
+
+void ExecutionStream::synchronize() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->idle.wait(lock, [this]() { return this->tasks.empty() && this->running == 0; });
+}
+
+void ExecutionStream::workerLoop() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->wakeUp.wait(lock, [this]() { return this->stop || !this->tasks.empty(); });
+        if (this->tasks.empty())
+            return;
+
+        // Take the whole queue, so the lock is not taken for every operation
+        std::deque<std::packaged_task<Tensor()>> batch;
+        batch.swap(this->tasks);
+        this->running = batch.size();
+        lock.unlock();
+
+        for (auto& task : batch)
+            task();
+
+        lock.lock();
+        this->running = 0;
+        if (this->tasks.empty())
+            this->idle.notify_all();
+    }
+}
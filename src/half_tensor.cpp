@@ -0,0 +1,227 @@
+#include "half_tensor.hpp"
+#include "tensor.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+HalfTensor::HalfTensor(const Shape& shape, double defaultValue, Precision precision)
+    :shape(shape), precision(precision)
+{
+    this->totalSize = 1;
+    for (size_t dim : shape)
+        this->totalSize *= dim;
+
+    this->data = std::make_shared<uint16_t[]>(this->totalSize);
+    std::fill_n(this->data.get(), this->totalSize, fromFloat((float) defaultValue, precision));
+}
+
+HalfTensor::HalfTensor(const Tensor& tensor, Precision precision)
+    :HalfTensor(tensor.resolved().shape, 0.0, precision)
+{
+    const double * in = tensor.resolved().data.get();
+    uint16_t * out = this->data.get();
+    Tensor::parallelFor(this->totalSize, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            out[i] = fromFloat((float) in[i], precision);
+    });
+}
+
+Tensor HalfTensor::toTensor() const {
+    Tensor result(this->shape, 0.0);
+    const uint16_t * in = this->data.get();
+    double * out = result.data.get();
+    const Precision precision = this->precision;
+    Tensor::parallelFor(this->totalSize, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            out[i] = toFloat(in[i], precision);
+    });
+
+    return result;
+}
+
+HalfTensor HalfTensor::mulmat(const HalfTensor& other) const {
+    if (other.shape.size() != 2 || this->shape.back() != other.shape[0])
+        return HalfTensor({0}, 0.0, this->precision);
+
+    const size_t cols = this->shape.back();
+    const size_t otherCols = other.shape[1];
+    Shape resShape = this->shape;
+    resShape[resShape.size() - 1] = otherCols;
+    HalfTensor result(resShape, 0.0, this->precision);
+    // Product with empty inner dimension is zero
+    if (cols == 0 || result.totalSize == 0)
+        return result;
+
+    const size_t rows = this->totalSize / cols;
+
+    const uint16_t * a = this->data.get();
+    const uint16_t * b = other.data.get();
+    uint16_t * res = result.data.get();
+    const Precision aPrecision = this->precision, bPrecision = other.precision;
+    Tensor::parallelFor(rows, [=](size_t begin, size_t end) {
+        // Row of the result is accumulated in float and stored once
+        std::vector<float> acc(otherCols);
+        for (size_t i = begin; i < end; i++) {
+            std::fill(acc.begin(), acc.end(), 0.0f);
+            for (size_t k = 0; k < cols; k++) {
+                const float aik = toFloat(a[i * cols + k], aPrecision);
+                const uint16_t * bRow = b + k * otherCols;
+                for (size_t j = 0; j < otherCols; j++)
+                    acc[j] += aik * toFloat(bRow[j], bPrecision);
+            }
+            for (size_t j = 0; j < otherCols; j++)
+                res[i * otherCols + j] = fromFloat(acc[j], aPrecision);
+        }
+    }, (1 << 15) / (cols * otherCols) + 1);
+
+    return result;
+}
+
+double HalfTensor::sum() const {
+    // Sum blocks in float, block results are added in double
+    const size_t blockSize = 1 << 12;
+    const size_t blocks = (this->totalSize + blockSize - 1) / blockSize;
+    std::vector<float> partial(blocks);
+    const uint16_t * in = this->data.get();
+    const Precision precision = this->precision;
+    const size_t size = this->totalSize;
+    Tensor::parallelFor(blocks, [&](size_t begin, size_t end) {
+        for (size_t block = begin; block < end; block++) {
+            float acc[8] = {};
+            const size_t last = std::min(size, (block + 1) * blockSize);
+            size_t i = block * blockSize;
+            for (; i + 8 <= last; i += 8)
+                for (size_t j = 0; j < 8; j++)
+                    acc[j] += toFloat(in[i + j], precision);
+            for (; i < last; i++)
+                acc[0] += toFloat(in[i], precision);
+            partial[block] = ((acc[0] + acc[1]) + (acc[2] + acc[3]))
+                + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+        }
+    }, 8);
+
+    double total = 0.0;
+    for (float value : partial)
+        total += value;
+    return total;
+}
+
+HalfTensor HalfTensor::operator+(const HalfTensor& other) const {
+    return elementwise(other, '+');
+}
+
+HalfTensor HalfTensor::operator-(const HalfTensor& other) const {
+    return elementwise(other, '-');
+}
+
+HalfTensor HalfTensor::operator*(const HalfTensor& other) const {
+    return elementwise(other, '*');
+}
+
+HalfTensor HalfTensor::elementwise(const HalfTensor& other, char operation) const {
+    if (!(this->shape == other.shape))
+        return HalfTensor({0}, 0.0, this->precision);
+
+    HalfTensor result(this->shape, 0.0, this->precision);
+    const uint16_t * a = this->data.get();
+    const uint16_t * b = other.data.get();
+    uint16_t * res = result.data.get();
+    const Precision aPrecision = this->precision, bPrecision = other.precision;
+    Tensor::parallelFor(this->totalSize, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const float x = toFloat(a[i], aPrecision), y = toFloat(b[i], bPrecision);
+            const float value = operation == '+' ? x + y : operation == '-' ? x - y : x * y;
+            res[i] = fromFloat(value, aPrecision);
+        }
+    });
+
+    return result;
+}
+
+double HalfTensor::operator[](size_t index) const {
+    return toFloat(this->data[index], this->precision);
+}
+
+const Shape& HalfTensor::getShape() const {
+    return this->shape;
+}
+
+HalfTensor::Precision HalfTensor::getPrecision() const {
+    return this->precision;
+}
+
+std::ostream& operator<<(std::ostream& os, const HalfTensor& tensor) {
+    os << (tensor.precision == HalfTensor::Precision::BFloat16 ? "bfloat16 " : "float16 ");
+    return os << tensor.toTensor();
+}
+
+uint16_t HalfTensor::fromFloat(float value, Precision precision) {
+    const uint32_t bits = std::bit_cast<uint32_t>(value);
+
+    if (precision == Precision::BFloat16) {
+        // Keep NaN as NaN, rounding could turn it into infinity
+        if ((bits & 0x7FFFFFFF) > 0x7F800000)
+            return (uint16_t) ((bits >> 16) | 0x40);
+        // Upper half of float, rounded to nearest even
+        return (uint16_t) ((bits + 0x7FFF + ((bits >> 16) & 1)) >> 16);
+    }
+
+    const uint16_t sign = (uint16_t) ((bits >> 16) & 0x8000);
+    const uint32_t absBits = bits & 0x7FFFFFFF;
+
+    // NaN and infinity
+    if (absBits >= 0x7F800000)
+        return sign | (absBits > 0x7F800000 ? 0x7E00 : 0x7C00);
+    // Values from 65520 are rounded to infinity
+    if (absBits >= 0x477FF000)
+        return sign | 0x7C00;
+
+    // Values under 2^-14 are subnormal in float16 (units of 2^-24)
+    if (absBits < 0x38800000) {
+        if (absBits < 0x33000000)
+            return sign;
+        const uint32_t exponent = absBits >> 23;
+        const uint32_t mantissa = (absBits & 0x7FFFFF) | 0x800000;
+        const uint32_t shift = 126 - exponent;
+        uint32_t result = mantissa >> shift;
+        const uint32_t rest = mantissa & ((1u << shift) - 1);
+        const uint32_t half = 1u << (shift - 1);
+        if (rest > half || (rest == half && (result & 1)))
+            result++;
+        return sign | (uint16_t) result;
+    }
+
+    // Normal values, change exponent bias from 127 to 15 and round mantissa
+    uint32_t result = (absBits - 0x38000000) >> 13;
+    const uint32_t rest = absBits & 0x1FFF;
+    if (rest > 0x1000 || (rest == 0x1000 && (result & 1)))
+        result++;
+    return sign | (uint16_t) result;
+}
+
+float HalfTensor::toFloat(uint16_t bits, Precision precision) {
+    if (precision == Precision::BFloat16)
+        return std::bit_cast<float>((uint32_t) bits << 16);
+
+    const uint32_t sign = (uint32_t) (bits & 0x8000) << 16;
+    const uint32_t exponent = (bits >> 10) & 0x1F;
+    const uint32_t mantissa = bits & 0x3FF;
+
+    // Zero and subnormal values
+    if (exponent == 0) {
+        const float value = std::ldexp((float) mantissa, -24);
+        return sign != 0 ? -value : value;
+    }
+    // NaN and infinity
+    if (exponent == 0x1F)
+        return std::bit_cast<float>(sign | 0x7F800000 | (mantissa << 13));
+
+    return std::bit_cast<float>(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+double HalfTensor::maxValue(Precision precision) {
+    return precision == Precision::BFloat16 ? 3.3895313892515355e38 : 65504.0;
+}
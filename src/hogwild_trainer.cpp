@@ -0,0 +1,103 @@
+#include "hogwild_trainer.hpp"
+#include "tensor.hpp"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+HogwildTrainer::HogwildTrainer(const std::vector<Tensor*>& params, LossFunction lossFunction,
+    size_t workerCount)
+    :params(params), lossFunction(lossFunction),
+    workerCount(workerCount != 0 ? workerCount : std::max(1u, std::thread::hardware_concurrency()))
+{}
+
+double HogwildTrainer::train(const Tensor& x, const Tensor& y, size_t batchSize, size_t epochs,
+    double learningRate)
+{
+    if (batchSize == 0)
+        throw std::invalid_argument("HogwildTrainer: batchSize has to be positive");
+
+    const size_t rows = x.resolved().shape[0];
+    const size_t batches = (rows + batchSize - 1) / batchSize;
+    const size_t total = batches * epochs;
+    std::atomic<size_t> next = 0;
+    std::vector<double> losses(this->workerCount, 0.0);
+    std::vector<std::exception_ptr> errors(this->workerCount);
+
+    auto work = [&](size_t index) {
+        // Replicas have their own data, shared parameters are accessed only
+        // with atomic loads and additions
+        std::vector<Tensor> replicas;
+        for (const Tensor * param : this->params)
+            replicas.emplace_back(param->shape, 0.0, param->requiresGrad);
+
+        // Mini-batches are taken in order, only counter is shared
+        for (size_t task = next.fetch_add(1, std::memory_order_relaxed); task < total;
+            task = next.fetch_add(1, std::memory_order_relaxed))
+        {
+            const size_t begin = (task % batches) * batchSize;
+            const size_t end = std::min(rows, begin + batchSize);
+            Tensor xBatch = x.rowsView(begin, end);
+            Tensor yBatch = y.rowsView(begin, end);
+
+            // Take snapshot of shared parameters, values can come from
+            // different updates
+            for (size_t p = 0; p < replicas.size(); p++) {
+                double * shared = this->params[p]->data.get();
+                double * data = replicas[p].data.get();
+                for (size_t i = 0; i < replicas[p].totalSize; i++)
+                    data[i] = std::atomic_ref<double>(shared[i]).load(std::memory_order_relaxed);
+                replicas[p].resetGrad();
+            }
+            Tensor loss = this->lossFunction(replicas, xBatch, yBatch);
+            loss.backward();
+            if (task / batches == epochs - 1)
+                losses[index] += loss.data[0];
+
+            // Only values with gradient are touched, other threads see every
+            // update complete but in any order
+            for (size_t p = 0; p < replicas.size(); p++) {
+                if (replicas[p].grad == nullptr)
+                    continue;
+                double * data = this->params[p]->data.get();
+                const double * grad = replicas[p].grad->data.get();
+                for (size_t i = 0; i < replicas[p].totalSize; i++) {
+                    if (grad[i] != 0.0)
+                        std::atomic_ref<double>(data[i]).fetch_sub(learningRate * grad[i],
+                            std::memory_order_relaxed);
+                }
+            }
+        }
+    };
+
+    auto worker = [&](size_t index) {
+        Tensor::singleThreaded = this->workerCount > 1;
+        try {
+            work(index);
+        } catch (...) {
+            // Other workers finish their current mini-batch and stop
+            errors[index] = std::current_exception();
+            next.store(total, std::memory_order_relaxed);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < this->workerCount; i++)
+        threads.emplace_back(worker, i);
+    const bool wasSingleThreaded = Tensor::singleThreaded;
+    worker(0);
+    Tensor::singleThreaded = wasSingleThreaded;
+    for (std::thread& thread : threads)
+        thread.join();
+
+    for (std::exception_ptr& error : errors)
+        if (error != nullptr)
+            std::rethrow_exception(error);
+
+    double loss = 0.0;
+    for (double value : losses)
+        loss += value;
+    return batches > 0 ? loss / batches : 0.0;
+}
@@ -0,0 +1,104 @@
+#include "inference_server.hpp"
+#include "tensor.hpp"
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <utility>
+
+InferenceServer::InferenceServer(Model model, const std::vector<Tensor*>& params,
+    size_t inputSize, size_t maxBatch, std::chrono::microseconds maxLatency)
+    :model(model), inputSize(inputSize), maxBatch(std::max<size_t>(1, maxBatch)),
+    maxLatency(maxLatency), stop(false)
+{
+    // Views of parameters have no gradient, so forward doesn't build graph
+    for (const Tensor * param : params)
+        this->params.push_back(param->rowsView(0, param->shape[0]));
+    this->requests.reserve(this->maxBatch);
+    this->worker = std::thread([this]() { workerLoop(); });
+}
+
+InferenceServer::~InferenceServer() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stop = true;
+    }
+    this->wakeUp.notify_one();
+    this->worker.join();
+}
+
+std::future<Tensor> InferenceServer::infer(const Tensor& placeholder) {
+    // Row can be shared by callers, so it is read without resolving it
+    const Tensor& row = placeholder.resolved();
+    std::promise<Tensor> result;
+    std::future<Tensor> future = result.get_future();
+    if (row.totalSize != this->inputSize) {
+        result.set_value(Tensor({0}, 0.0));
+        return future;
+    }
+
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->requests.push_back({row, std::chrono::steady_clock::now(), std::move(result)});
+        // Batching thread waits for the first row and for full batch
+        wake = this->requests.size() == 1 || this->requests.size() >= this->maxBatch;
+    }
+    if (wake)
+        this->wakeUp.notify_one();
+    return future;
+}
+
+void InferenceServer::workerLoop() {
+    std::vector<Request> batch;
+    batch.reserve(this->maxBatch);
+
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->wakeUp.wait(lock, [this]() { return this->stop || !this->requests.empty(); });
+        if (this->requests.empty())
+            return;
+
+        // Wait for more rows until the oldest one reaches its deadline
+        const auto deadline = this->requests.front().arrival + this->maxLatency;
+        this->wakeUp.wait_until(lock, deadline, [this]() {
+            return this->stop || this->requests.size() >= this->maxBatch;
+        });
+
+        // Take at most maxBatch oldest rows, the rest waits for next batch
+        const size_t count = std::min(this->requests.size(), this->maxBatch);
+        std::move(this->requests.begin(), this->requests.begin() + count,
+            std::back_inserter(batch));
+        this->requests.erase(this->requests.begin(), this->requests.begin() + count);
+        lock.unlock();
+
+        runBatch(batch);
+        batch.clear();
+
+        lock.lock();
+    }
+}
+
+void InferenceServer::runBatch(std::vector<Request>& batch) {
+    const size_t rows = batch.size();
+    Tensor x({rows, this->inputSize}, 0.0);
+    for (size_t i = 0; i < rows; i++)
+        std::memcpy(x.data.get() + i * this->inputSize, batch[i].row.data.get(),
+            this->inputSize * sizeof(double));
+
+    Tensor y({0}, 0.0);
+    try {
+        y = this->model(this->params, x);
+        y.wait();
+    } catch (...) {
+        for (Request& request : batch)
+            request.result.set_exception(std::current_exception());
+        return;
+    }
+
+    // Every caller gets view of its row, the batch stays alive while any of
+    // them is used
+    const bool valid = y.shape.size() != 0 && y.shape[0] == rows;
+    for (size_t i = 0; i < rows; i++)
+        batch[i].result.set_value(valid ? y.rowsView(i, i + 1) : Tensor({0}, 0.0));
+}
@@ -0,0 +1,69 @@
+#include "loss_scaler.hpp"
+#include "half_tensor.hpp"
+#include "tensor.hpp"
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+LossScaler::LossScaler(HalfTensor::Precision precision, double initialScale, size_t growthInterval)
+    :scale(initialScale), growthInterval(growthInterval), goodSteps(0), precision(precision)
+{}
+
+Tensor LossScaler::scaleLoss(Tensor& loss) const {
+    return loss * this->scale;
+}
+
+bool LossScaler::unscale(const std::vector<Tensor*>& params) {
+    std::atomic<bool> overflow = false;
+
+    // Values above max of the format are rounded to infinity, NaN stays NaN
+    this->grads.clear();
+    for (Tensor * param : params) {
+        if (!param->grad)
+            continue;
+        const HalfTensor& grad = this->grads.emplace_back(*param->grad, this->precision);
+        Tensor::parallelFor(param->totalSize, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                if (!std::isfinite(grad[i])) {
+                    overflow = true;
+                    return;
+                }
+            }
+        });
+        if (overflow)
+            break;
+    }
+
+    if (overflow) {
+        this->scale /= 2.0;
+        this->goodSteps = 0;
+        return false;
+    }
+
+    const double inverse = 1.0 / this->scale;
+    size_t index = 0;
+    for (Tensor * param : params) {
+        if (!param->grad)
+            continue;
+        const HalfTensor& halfGrad = this->grads[index++];
+        double * grad = param->grad->data.get();
+        Tensor::parallelFor(param->totalSize, [&, grad](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                grad[i] = halfGrad[i] * inverse;
+        });
+    }
+
+    if (++this->goodSteps == this->growthInterval) {
+        this->scale *= 2.0;
+        this->goodSteps = 0;
+    }
+    return true;
+}
+
+const std::vector<HalfTensor>& LossScaler::getGrads() const {
+    return this->grads;
+}
+
+double LossScaler::getScale() const {
+    return this->scale;
+}
@@ -0,0 +1,292 @@
+#include "process_group.hpp"
+#include "tensor.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+void throwError(const std::string& message) {
+    throw std::runtime_error(message + ": " + std::strerror(errno));
+}
+
+void writeAll(int socket, const void * buffer, size_t size) {
+    const char * data = (const char *) buffer;
+    while (size > 0) {
+        ssize_t written = ::write(socket, data, size);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            throwError("ProcessGroup write failed");
+        data += written;
+        size -= written;
+    }
+}
+
+void readAll(int socket, void * buffer, size_t size) {
+    char * data = (char *) buffer;
+    while (size > 0) {
+        ssize_t received = ::read(socket, data, size);
+        if (received < 0 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            throwError("ProcessGroup read failed");
+        data += received;
+        size -= received;
+    }
+}
+
+sockaddr_un socketAddress(const std::string& name) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    const std::string path = "/tmp/" + name + ".sock";
+    if (path.size() >= sizeof(address.sun_path))
+        throw std::length_error("ProcessGroup name is too long");
+    std::strcpy(address.sun_path, path.c_str());
+    return address;
+}
+}
+
+ProcessGroup::ProcessGroup(const std::string& name, size_t rank, size_t size, size_t capacity)
+    :name(name), rank(rank), size(size), capacity(capacity), shared(nullptr),
+    sharedBytes((size + 1) * capacity * sizeof(double)), listenSocket(-1)
+{
+    const std::string shmName = "/" + name;
+    const sockaddr_un address = socketAddress(name);
+    int shm = -1;
+    // Connection not stored in sockets yet
+    int connection = -1;
+
+    try {
+        if (rank == 0) {
+            // Shared memory exists before anyone can connect
+            shm_unlink(shmName.c_str());
+            shm = shm_open(shmName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+            if (shm < 0 || ftruncate(shm, this->sharedBytes) != 0)
+                throwError("ProcessGroup shm_open failed");
+
+            this->listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+            unlink(address.sun_path);
+            if (this->listenSocket < 0
+                || bind(this->listenSocket, (const sockaddr *) &address, sizeof(address)) != 0
+                || listen(this->listenSocket, (int) size) != 0)
+                throwError("ProcessGroup listen failed");
+
+            // Every process sends its rank after connecting
+            this->sockets.assign(size - 1, -1);
+            for (size_t i = 1; i < size; i++) {
+                connection = accept(this->listenSocket, nullptr, nullptr);
+                if (connection < 0)
+                    throwError("ProcessGroup accept failed");
+                size_t otherRank = 0;
+                readAll(connection, &otherRank, sizeof(otherRank));
+                if (otherRank == 0 || otherRank >= size || this->sockets[otherRank - 1] != -1)
+                    throw std::runtime_error("ProcessGroup got invalid rank");
+                this->sockets[otherRank - 1] = connection;
+                connection = -1;
+            }
+        } else {
+            // Rank 0 may not be listening yet
+            for (size_t attempt = 0; connection < 0; attempt++) {
+                connection = socket(AF_UNIX, SOCK_STREAM, 0);
+                if (connection < 0)
+                    throwError("ProcessGroup socket failed");
+                if (connect(connection, (const sockaddr *) &address, sizeof(address)) == 0)
+                    break;
+                close(connection);
+                connection = -1;
+                if (attempt == 1000)
+                    throwError("ProcessGroup connect failed");
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            this->sockets.push_back(connection);
+            connection = -1;
+            writeAll(this->sockets[0], &this->rank, sizeof(this->rank));
+
+            shm = shm_open(shmName.c_str(), O_RDWR, 0600);
+            if (shm < 0)
+                throwError("ProcessGroup shm_open failed");
+        }
+
+        void * memory = mmap(nullptr, this->sharedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, shm, 0);
+        close(shm);
+        shm = -1;
+        if (memory == MAP_FAILED)
+            throwError("ProcessGroup mmap failed");
+        this->shared = (double *) memory;
+
+        // All processes have mapped shared memory, it can be unlinked
+        barrier();
+        if (rank == 0)
+            shm_unlink(shmName.c_str());
+    } catch (...) {
+        // Destructor doesn't run for partly constructed object
+        if (shm >= 0)
+            close(shm);
+        if (connection >= 0)
+            close(connection);
+        if (rank == 0)
+            shm_unlink(shmName.c_str());
+        release();
+        throw;
+    }
+}
+
+ProcessGroup::~ProcessGroup() {
+    release();
+}
+
+void ProcessGroup::allReduce(const std::vector<Tensor*>& params) {
+    const std::vector<size_t> offsets = getOffsets(params);
+    for (size_t i = 0; i < params.size(); i++) {
+        if (params[i]->grad != nullptr)
+            reduce(params[i]->grad->data.get(), offsets[i], params[i]->totalSize);
+    }
+}
+
+void ProcessGroup::backward(Tensor& loss, const std::vector<Tensor*>& params) {
+    const std::vector<size_t> offsets = getOffsets(params);
+    std::vector<bool> ready(params.size(), false);
+    std::mutex mutex;
+    std::condition_variable condition;
+
+    // Parameters are reduced in the given order, so all processes pair the
+    // same parameters, even if their gradients are ready in different order
+    std::exception_ptr error;
+    std::thread communication([&]() {
+        try {
+            for (size_t i = 0; i < params.size(); i++) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    condition.wait(lock, [&]() {return ready[i];});
+                }
+                if (params[i]->grad != nullptr)
+                    reduce(params[i]->grad->data.get(), offsets[i], params[i]->totalSize);
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+    });
+
+    // Communication thread is joined on every path
+    std::exception_ptr backwardError;
+    try {
+        loss.backward([&](const Tensor& leaf) {
+            for (size_t i = 0; i < params.size(); i++) {
+                if (leaf.grad != nullptr && leaf.grad == params[i]->grad) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ready[i] = true;
+                    condition.notify_one();
+                }
+            }
+        });
+    } catch (...) {
+        backwardError = std::current_exception();
+    }
+
+    // Parameters not used by the graph still take part in reduction
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::fill(ready.begin(), ready.end(), true);
+    }
+    condition.notify_one();
+    communication.join();
+
+    if (backwardError)
+        std::rethrow_exception(backwardError);
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void ProcessGroup::broadcast(const std::vector<Tensor*>& params) {
+    const std::vector<size_t> offsets = getOffsets(params);
+    double * result = this->shared + this->size * this->capacity;
+    if (this->rank == 0)
+        for (size_t i = 0; i < params.size(); i++)
+            std::copy_n(params[i]->data.get(), params[i]->totalSize, result + offsets[i]);
+    barrier();
+    if (this->rank != 0)
+        for (size_t i = 0; i < params.size(); i++)
+            std::copy_n(result + offsets[i], params[i]->totalSize, params[i]->data.get());
+    barrier();
+}
+
+void ProcessGroup::barrier() {
+    char token = 0;
+    if (this->rank == 0) {
+        for (int socket : this->sockets)
+            readAll(socket, &token, 1);
+        for (int socket : this->sockets)
+            writeAll(socket, &token, 1);
+    } else {
+        writeAll(this->sockets[0], &token, 1);
+        readAll(this->sockets[0], &token, 1);
+    }
+}
+
+void ProcessGroup::release() {
+    if (this->shared != nullptr)
+        munmap(this->shared, this->sharedBytes);
+    this->shared = nullptr;
+    for (int socket : this->sockets) {
+        if (socket >= 0)
+            close(socket);
+    }
+    this->sockets.clear();
+    if (this->listenSocket >= 0) {
+        close(this->listenSocket);
+        unlink(socketAddress(this->name).sun_path);
+    }
+    this->listenSocket = -1;
+}
+
+size_t ProcessGroup::getRank() const {
+    return this->rank;
+}
+
+size_t ProcessGroup::getSize() const {
+    return this->size;
+}
+
+void ProcessGroup::reduce(double * values, size_t offset, size_t count) {
+    double * result = this->shared + this->size * this->capacity;
+    std::copy_n(values, count, this->shared + this->rank * this->capacity + offset);
+    barrier();
+
+    // Every process sums its own part over all slots in the same order
+    const size_t begin = offset + count * this->rank / this->size;
+    const size_t end = offset + count * (this->rank + 1) / this->size;
+    for (size_t i = begin; i < end; i++) {
+        double sum = 0.0;
+        for (size_t r = 0; r < this->size; r++)
+            sum += this->shared[r * this->capacity + i];
+        result[i] = sum / this->size;
+    }
+    barrier();
+
+    std::copy_n(result + offset, count, values);
+}
+
+std::vector<size_t> ProcessGroup::getOffsets(const std::vector<Tensor*>& params) const {
+    std::vector<size_t> offsets;
+    size_t offset = 0;
+    for (const Tensor * param : params) {
+        offsets.push_back(offset);
+        offset += param->totalSize;
+    }
+    if (offset > this->capacity)
+        throw std::length_error("Parameters don't fit into ProcessGroup capacity");
+    return offsets;
+}
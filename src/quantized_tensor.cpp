@@ -0,0 +1,120 @@
+#include "quantized_tensor.hpp"
+#include "tensor.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#if defined(__AVX512VNNI__) || defined(__AVXVNNI__)
+#include <immintrin.h>
+#endif
+
+QuantizedTensor::QuantizedTensor(const Tensor& weight)
+    :rows(weight.resolved().shape[0]), cols(weight.resolved().strides[0])
+{
+    this->paddedRows = (this->rows + 63) / 64 * 64;
+    this->data = std::make_shared<int8_t[]>(this->cols * this->paddedRows);
+    this->scales = std::make_shared<float[]>(this->cols);
+    this->sums = std::make_shared<int32_t[]>(this->cols);
+
+    const double * w = weight.resolved().data.get();
+    for (size_t j = 0; j < this->cols; j++) {
+        double maxAbs = 0.0;
+        for (size_t i = 0; i < this->rows; i++)
+            maxAbs = std::max(maxAbs, std::abs(w[i * this->cols + j]));
+
+        const float scale = maxAbs > 0.0 ? (float) (maxAbs / 127.0) : 1.0f;
+        int8_t * column = this->data.get() + j * this->paddedRows;
+        int32_t sum = 0;
+        for (size_t i = 0; i < this->rows; i++) {
+            column[i] = (int8_t) std::lround(w[i * this->cols + j] / scale);
+            sum += column[i];
+        }
+        this->scales[j] = scale;
+        this->sums[j] = sum;
+    }
+}
+
+Tensor QuantizedTensor::dequantize() const {
+    Tensor result({this->rows, this->cols}, 0.0);
+    for (size_t j = 0; j < this->cols; j++)
+        for (size_t i = 0; i < this->rows; i++)
+            result[i * this->cols + j] = this->data[j * this->paddedRows + i] * this->scales[j];
+
+    return result;
+}
+
+Shape QuantizedTensor::getShape() const {
+    return {this->rows, this->cols};
+}
+
+int32_t QuantizedTensor::dotKernel(const uint8_t * a, const int8_t * b, size_t size) {
+#if defined(__AVX512VNNI__)
+    __m512i acc = _mm512_setzero_si512();
+    for (size_t i = 0; i < size; i += 64)
+        acc = _mm512_dpbusd_epi32(acc, _mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+    return _mm512_reduce_add_epi32(acc);
+#elif defined(__AVXVNNI__)
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t i = 0; i < size; i += 32)
+        acc = _mm256_dpbusd_avx_epi32(acc, _mm256_loadu_si256((const __m256i *) (a + i)),
+            _mm256_loadu_si256((const __m256i *) (b + i)));
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    return _mm_cvtsi128_si32(sum);
+#else
+    int32_t acc = 0;
+    for (size_t i = 0; i < size; i++)
+        acc += (int32_t) a[i] * b[i];
+    return acc;
+#endif
+}
+
+Tensor Tensor::mulmat(const QuantizedTensor& other) const {
+    if (this->pending != nullptr)
+        return resolved().mulmat(other);
+    if (this->shape.back() != other.rows)
+        return Tensor({0}, 0.0);
+
+    Shape resShape = this->shape;
+    resShape[resShape.size() - 1] = other.cols;
+    Tensor result(resShape, 0.0);
+    // Product with empty inner dimension is zero
+    if (other.rows == 0 || result.totalSize == 0)
+        return result;
+
+    const size_t rows = this->totalSize / other.rows;
+    const size_t depth = other.rows;
+    const size_t paddedDepth = other.paddedRows;
+    const size_t cols = other.cols;
+    const double * in = this->data.get();
+    double * out = result.data.get();
+
+    parallelFor(rows, [&](size_t begin, size_t end) {
+        std::vector<uint8_t> row(paddedDepth);
+        for (size_t i = begin; i < end; i++) {
+            // Quantize row of activations symmetrically and shift it by 128,
+            // so it fits into unsigned 8-bit integers
+            const double * x = in + i * depth;
+            double maxAbs = 0.0;
+            for (size_t k = 0; k < depth; k++)
+                maxAbs = std::max(maxAbs, std::abs(x[k]));
+            const float rowScale = maxAbs > 0.0 ? (float) (maxAbs / 127.0) : 1.0f;
+            for (size_t k = 0; k < depth; k++)
+                row[k] = (uint8_t) (std::lround(x[k] / rowScale) + 128);
+            // Padding is multiplied by zero weights
+            std::fill(row.begin() + depth, row.end(), 128);
+
+            // Accumulate in int32, remove the shift and requantize to float
+            for (size_t j = 0; j < cols; j++) {
+                int32_t acc = QuantizedTensor::dotKernel(row.data(),
+                    other.data.get() + j * paddedDepth, paddedDepth);
+                acc -= 128 * other.sums[j];
+                out[i * cols + j] = (float) acc * (rowScale * other.scales[j]);
+            }
+        }
+    }, (1 << 15) / (depth * cols) + 1);
+
+    return result;
+}
@@ -0,0 +1,175 @@
+#include "sparse_tensor.hpp"
+#include "tensor.hpp"
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <unordered_set>
+#include <vector>
+
+SparseTensor::SparseTensor(size_t rows, size_t cols, const std::vector<size_t>& rowIndexes,
+    const std::vector<size_t>& colIndexes, const std::vector<double>& values)
+    :rows(rows), cols(cols)
+{
+    this->rowOffsets = std::make_shared<std::vector<size_t>>(rows + 1, 0);
+    this->colIndexes = std::make_shared<std::vector<size_t>>();
+    this->values = std::make_shared<std::vector<double>>();
+    this->transposed = std::make_shared<Transposed>();
+
+    // Sort elements by row and column
+    std::vector<size_t> order(std::min({rowIndexes.size(), colIndexes.size(), values.size()}));
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (rowIndexes[a] != rowIndexes[b])
+            return rowIndexes[a] < rowIndexes[b];
+        return colIndexes[a] < colIndexes[b];
+    });
+
+    // Fill CSR arrays, skip elements out of shape and sum duplicates
+    size_t lastRow = rows, lastCol = cols;
+    for (size_t i : order) {
+        const size_t row = rowIndexes[i], col = colIndexes[i];
+        if (row >= rows || col >= cols)
+            continue;
+
+        if (row == lastRow && col == lastCol) {
+            this->values->back() += values[i];
+            continue;
+        }
+        lastRow = row;
+        lastCol = col;
+
+        this->colIndexes->push_back(col);
+        this->values->push_back(values[i]);
+        (*this->rowOffsets)[row + 1]++;
+    }
+
+    // Turn counts of elements in rows into offsets
+    for (size_t row = 0; row < rows; row++)
+        (*this->rowOffsets)[row + 1] += (*this->rowOffsets)[row];
+}
+
+SparseTensor SparseTensor::fromDense(const Tensor& dense) {
+    if (dense.pending != nullptr)
+        return fromDense(dense.resolved());
+    const size_t rows = dense.shape[0];
+    const size_t cols = dense.strides[0];
+
+    std::vector<size_t> rowIndexes, colIndexes;
+    std::vector<double> values;
+    for (size_t i = 0; i < rows; i++) {
+        for (size_t j = 0; j < cols; j++) {
+            if (dense.data[i * cols + j] != 0.0) {
+                rowIndexes.push_back(i);
+                colIndexes.push_back(j);
+                values.push_back(dense.data[i * cols + j]);
+            }
+        }
+    }
+
+    return SparseTensor(rows, cols, rowIndexes, colIndexes, values);
+}
+
+Tensor SparseTensor::mulmat(Tensor& other) const {
+    other.wait();
+    if (other.shape.size() != 2 || other.shape[0] != this->cols)
+        return Tensor({0}, 0.0);
+
+    const size_t n = other.shape[1];
+    Tensor result({this->rows, n}, 0.0);
+    if (other.requiresGrad) {
+        std::unordered_set<Tensor, Tensor::HashFunction, Tensor::EqualFunction> children = {other};
+        result = Tensor({this->rows, n}, 0.0, true, "sparseMulmat", children);
+    }
+
+    mulmatKernel(*this, other.data.get(), result.data.get(), n);
+
+    if (!other.requiresGrad)
+        return result;
+
+    // dOther = A^T * dRes, transposed tensor is used, so every row of
+    // gradient is written by one thread only
+    std::shared_ptr<const SparseTensor> sparseT = getTransposed();
+    std::shared_ptr<Tensor> otherGrad = other.grad, resGrad = result.grad;
+    result._backward = std::make_shared<std::function<void()>>(
+        [sparseT, otherGrad, resGrad, n]() {
+            mulmatKernel(*sparseT, resGrad->data.get(), otherGrad->data.get(), n);
+            otherGrad->isGradInit = true;
+        });
+
+    return result;
+}
+
+void SparseTensor::mulmatKernel(const SparseTensor& sparse, const double * dense, double * res,
+    size_t n)
+{
+    if (n == 0)
+        return;
+
+    const size_t * offsets = sparse.rowOffsets->data();
+    const size_t * indexes = sparse.colIndexes->data();
+    const double * values = sparse.values->data();
+
+    // Rows are independent, cost of a row is its number of elements
+    const size_t averageRow = sparse.nonZeros() / std::max<size_t>(1, sparse.rows) + 1;
+    Tensor::parallelFor(sparse.rows, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            double * resRow = res + i * n;
+            for (size_t e = offsets[i]; e < offsets[i + 1]; e++) {
+                const double value = values[e];
+                const double * denseRow = dense + indexes[e] * n;
+                for (size_t j = 0; j < n; j++)
+                    resRow[j] += value * denseRow[j];
+            }
+        }
+    }, (1 << 15) / (averageRow * n) + 1);
+}
+
+std::shared_ptr<const SparseTensor> SparseTensor::getTransposed() const {
+    // Shared tensor is used by more threads (e.g. by trainers), only one of
+    // them creates the transposed tensor
+    std::call_once(this->transposed->created, [this]() {
+        std::vector<size_t> rowIndexes(this->nonZeros());
+        for (size_t i = 0; i < this->rows; i++)
+            for (size_t e = (*this->rowOffsets)[i]; e < (*this->rowOffsets)[i + 1]; e++)
+                rowIndexes[e] = i;
+
+        this->transposed->tensor = std::make_shared<SparseTensor>(this->cols, this->rows,
+            *this->colIndexes, rowIndexes, *this->values);
+    });
+    return this->transposed->tensor;
+}
+
+Tensor SparseTensor::toDense() const {
+    Tensor dense({this->rows, this->cols}, 0.0);
+    for (size_t i = 0; i < this->rows; i++)
+        for (size_t e = (*this->rowOffsets)[i]; e < (*this->rowOffsets)[i + 1]; e++)
+            dense[i * this->cols + (*this->colIndexes)[e]] = (*this->values)[e];
+
+    return dense;
+}
+
+size_t SparseTensor::nonZeros() const {
+    return this->values->size();
+}
+
+Shape SparseTensor::getShape() const {
+    return {this->rows, this->cols};
+}
+
+std::ostream& operator<<(std::ostream& os, const SparseTensor& tensor) {
+    os << "Sparse Tensor: [" << tensor.rows << " " << tensor.cols << "]"
+        << " ,nonZeros: " << tensor.nonZeros() << std::endl;
+
+    // Print stored elements as (row, column): value
+    os << "[";
+    for (size_t i = 0; i < tensor.rows; i++) {
+        for (size_t e = (*tensor.rowOffsets)[i]; e < (*tensor.rowOffsets)[i + 1]; e++) {
+            os << "(" << i << ", " << (*tensor.colIndexes)[e] << "): " << (*tensor.values)[e]
+                << (e != tensor.nonZeros() - 1 ? ", " : "");
+        }
+    }
+    os << "]";
+    return os;
+}
@@ -1,34 +1,94 @@
 #include "tensor.hpp"
+#include "thread_pool.hpp"
 #include <functional>
 #include <memory>
 #include <algorithm>
+#include <array>
+#include <cmath>
+#include <exception>
+#include <mutex>
+#include <numbers>
+#include <stdexcept>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
-Tensor::Tensor(const std::vector<size_t>& shape, double defaultValue)
+Shape::Shape()
+    :rank(0)
+{}
+
+Shape::Shape(std::initializer_list<size_t> dims)
+    :rank(dims.size())
+{
+    if (dims.size() > MAX_DIMS)
+        throw std::length_error("Shape has more than Shape::MAX_DIMS dimensions");
+    std::copy(dims.begin(), dims.end(), this->dims.begin());
+}
+
+Shape::Shape(const std::vector<size_t>& dims)
+    :rank(dims.size())
+{
+    if (dims.size() > MAX_DIMS)
+        throw std::length_error("Shape has more than Shape::MAX_DIMS dimensions");
+    std::copy(dims.begin(), dims.end(), this->dims.begin());
+}
+
+size_t Shape::size() const {
+    return rank;
+}
+
+size_t Shape::operator[](size_t index) const {
+    return dims[index];
+}
+
+size_t& Shape::operator[](size_t index) {
+    return dims[index];
+}
+
+bool Shape::operator==(const Shape& other) const {
+    return std::equal(begin(), end(), other.begin(), other.end());
+}
+
+Shape::operator std::vector<size_t>() const {
+    return std::vector<size_t>(begin(), end());
+}
+
+size_t Shape::back() const {
+    return dims[rank - 1];
+}
+
+const size_t * Shape::begin() const {
+    return dims.data();
+}
+
+const size_t * Shape::end() const {
+    return dims.data() + rank;
+}
+
+Tensor::Tensor(const Shape& shape, double defaultValue)
     :Tensor(shape, defaultValue, false)
 {}
 
-Tensor::Tensor(const std::vector<size_t>& shape, double defaultValue,
+Tensor::Tensor(const Shape& shape, double defaultValue,
     bool requiresGrad, const std::string& operation,
-    const std::unordered_set<Tensor, HashFunction>& children)
+    const std::unordered_set<Tensor, HashFunction, EqualFunction>& children)
     :Tensor(shape, defaultValue, requiresGrad)
 {
     this->operation = operation;
     this->prev = children;
 }
 
-Tensor::Tensor(const std::vector<size_t>& shape,
+Tensor::Tensor(const Shape& shape,
     bool requiresGrad, const std::string& operation,
-    const std::unordered_set<Tensor, HashFunction>& children)
+    const std::unordered_set<Tensor, HashFunction, EqualFunction>& children)
     :Tensor(shape, requiresGrad)
 {
     this->operation = operation;
     this->prev = children;
 }
 
-Tensor::Tensor(const std::vector<size_t>& shape, double defaultValue, bool requiresGrad)
+Tensor::Tensor(const Shape& shape, double defaultValue, bool requiresGrad)
     :shape(shape)
 {
     this->requiresGrad = requiresGrad;
@@ -39,23 +99,23 @@ Tensor::Tensor(const std::vector<size_t>& shape, double defaultValue, bool requi
     this->_backward = nullptr;
     this->operation = "";
 
-    // Calculate memory size from shape
-    this->totalSize = shape[0];
-    for (size_t i = 1; i < shape.size(); i++) {
-        this->totalSize *= shape[i];
-    }
+    // Calculate memory size and strides from shape
+    initStrides();
 
-    // Allocate memory and initialize it
-    this->data = std::make_shared<double[]>(this->totalSize);
-    for (size_t i = 0; i < this->totalSize; i++)
-        this->data[i] = defaultValue;
+    // Allocate memory and initialize it, pages are touched first by threads
+    // that will process them
+    this->data = allocate(this->totalSize);
+    double * values = this->data.get();
+    parallelFor(this->totalSize, [=](size_t begin, size_t end) {
+        std::fill(values + begin, values + end, defaultValue);
+    });
 }
 
-Tensor::Tensor(const std::vector<size_t>& shape)
+Tensor::Tensor(const Shape& shape)
     :Tensor(shape, false)
 {}
 
-Tensor::Tensor(const std::vector<size_t>& shape, bool requiresGrad)
+Tensor::Tensor(const Shape& shape, bool requiresGrad)
     :shape(shape)
 {
     this->requiresGrad = requiresGrad;
@@ -66,20 +126,60 @@ Tensor::Tensor(const std::vector<size_t>& shape, bool requiresGrad)
     this->_backward = nullptr;
     this->operation = "";
 
-    // Calculate memory size from shape
-    this->totalSize = shape[0];
-    for (size_t i = 1; i < shape.size(); i++) {
-        this->totalSize *= shape[i];
-    }
+    // Calculate memory size and strides from shape
+    initStrides();
 
     // Allocate memory
-    this->data = std::make_shared<double[]>(this->totalSize);
+    this->data = allocate(this->totalSize);
     // initialize the memory with random values
-    for (size_t i = 0; i < this->totalSize; i++)
-        this->data[i] = getRandomNumber();
+    fillRandom(Distribution::Uniform, 0.0, 1.0);
+}
+
+Tensor Tensor::uniform(const Shape& shape, double low, double high,
+    bool requiresGrad)
+{
+    Tensor result(shape, 0.0, requiresGrad);
+    result.fillRandom(Distribution::Uniform, low, high);
+    return result;
+}
+
+Tensor Tensor::normal(const Shape& shape, double mean, double stddev,
+    bool requiresGrad)
+{
+    Tensor result(shape, 0.0, requiresGrad);
+    result.fillRandom(Distribution::Normal, mean, stddev);
+    return result;
+}
+
+Tensor Tensor::xavier(const Shape& shape, bool requiresGrad) {
+    auto [fanIn, fanOut] = getFans(shape);
+    double limit = std::sqrt(6.0 / (fanIn + fanOut));
+    return uniform(shape, -limit, limit, requiresGrad);
 }
 
-std::ostream& operator<<(std::ostream& os, const Tensor& tensor) {
+Tensor Tensor::he(const Shape& shape, bool requiresGrad) {
+    auto [fanIn, fanOut] = getFans(shape);
+    return normal(shape, 0.0, std::sqrt(2.0 / fanIn), requiresGrad);
+}
+
+void Tensor::initStrides() {
+    this->strides = this->shape;
+    this->totalSize = 1;
+    for (size_t i = this->shape.size(); i-- > 0;) {
+        this->strides[i] = this->totalSize;
+        this->totalSize *= this->shape[i];
+    }
+}
+
+std::pair<double, double> Tensor::getFans(const Shape& shape) {
+    if (shape.size() == 1)
+        return {(double) shape[0], (double) shape[0]};
+    return {(double) shape[shape.size() - 2], (double) shape[shape.size() - 1]};
+}
+
+std::ostream& operator<<(std::ostream& os, const Tensor& placeholder) {
+    const Tensor& tensor = placeholder.resolved();
+
     // Print shape
     os << tensor.shape.size() << "-D Tensor: [";
     for (size_t i = 0; i < tensor.shape.size(); i++) {
@@ -107,10 +207,12 @@ std::ostream& operator<<(std::ostream& os, const Tensor& tensor) {
 }
 
 double Tensor::operator[](size_t index) const {
-    return data[index];
+    return resolved().data[index];
 }
 
 double& Tensor::operator[](size_t index) {
+    if (this->pending != nullptr)
+        wait();
     return data[index];
 }
 
@@ -137,198 +239,745 @@ std::ostream& Tensor::toStreamHelper(std::ostream& os, const Tensor& tensor, siz
 }
 
 bool Tensor::compareShape(const Tensor& other) const {
-    if (other.shape.size() != this->shape.size()) return false;
+    return this->shape == other.shape;
+}
 
-    // Check if all dimensions are the same
-    for (size_t i = 0; i < this->shape.size(); i++)
-        if (other.shape[i] != this->shape[i])
-            return false;
+void Tensor::seed(uint64_t seed) {
+    rngSeed = seed;
+    rngOffset = 0;
+}
 
-    return true;
+namespace {
+/**
+ * Philox4x32-10 counter based random generator. Output depends only on the
+ * counter and the key, so any part of the random stream can be generated
+ * independently.
+ * @param counter Position in the random stream
+ * @param key Seed of the random stream
+ * @return Four random 32-bit numbers
+ */
+std::array<uint32_t, 4> philox(uint64_t counter, uint64_t key) {
+    const uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+    const uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+
+    std::array<uint32_t, 4> c = {(uint32_t) counter, (uint32_t) (counter >> 32), 0, 0};
+    uint32_t k0 = (uint32_t) key, k1 = (uint32_t) (key >> 32);
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t) M0 * c[0];
+        uint64_t p1 = (uint64_t) M1 * c[2];
+        c = {
+            (uint32_t) (p1 >> 32) ^ c[1] ^ k0, (uint32_t) p1,
+            (uint32_t) (p0 >> 32) ^ c[3] ^ k1, (uint32_t) p0
+        };
+        k0 += W0;
+        k1 += W1;
+    }
+    return c;
 }
 
-void Tensor::seed(uint64_t seed) {
-    gen.seed(seed);
+/**
+ * Convert two random 32-bit numbers to double in range [0, 1)
+ */
+double toUnitInterval(uint32_t hi, uint32_t lo) {
+    uint64_t bits = ((uint64_t) hi << 32 | lo) >> 11;
+    return bits * 0x1.0p-53;
+}
+}
+
+void Tensor::fillRandom(Distribution distribution, double a, double b) {
+    // Every counter generates two values, reserve counters for the whole tensor
+    const size_t pairs = (this->totalSize + 1) / 2;
+    const uint64_t base = rngOffset.fetch_add(pairs);
+    const uint64_t key = rngSeed;
+    double * out = this->data.get();
+    const size_t size = this->totalSize;
+
+    parallelFor(pairs, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            std::array<uint32_t, 4> r = philox(base + i, key);
+            double u0 = toUnitInterval(r[0], r[1]);
+            double u1 = toUnitInterval(r[2], r[3]);
+
+            double v0, v1;
+            if (distribution == Distribution::Uniform) {
+                v0 = a + (b - a) * u0;
+                v1 = a + (b - a) * u1;
+            } else {
+                // Box-Muller transform, 1 - u0 is never zero
+                double radius = b * std::sqrt(-2.0 * std::log(1.0 - u0));
+                double theta = 2.0 * std::numbers::pi * u1;
+                v0 = a + radius * std::cos(theta);
+                v1 = a + radius * std::sin(theta);
+            }
+
+            out[2 * i] = v0;
+            if (2 * i + 1 < size)
+                out[2 * i + 1] = v1;
+        }
+    });
 }
 
-double Tensor::getRandomNumber() {
-    return dis(gen);
+void Tensor::parallelFor(size_t size, const std::function<void(size_t, size_t)>& func,
+    size_t minChunk)
+{
+    if (singleThreaded) {
+        func(0, size);
+        return;
+    }
+    ThreadPool::global().parallelFor(size, func, minChunk);
 }
 
 Tensor Tensor::pow(double n) {
+    wait();
     Tensor out(this->shape, 0.0);
     bool requiresGrad = this->requiresGrad;
     if (requiresGrad) {
-        std::unordered_set<Tensor, HashFunction> children = {*this};
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {*this};
         out = Tensor(this->shape, 0.0, requiresGrad, operation, children);
     }
 
-    // Do the exp operation at data
-    for (size_t i = 0; i < this->totalSize; ++i) {
-        out[i] = std::pow(this->data[i], n);
-    }
+    // Do the pow operation at data
+    const double * in = this->data.get();
+    double * res = out.data.get();
+    parallelFor(this->totalSize, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            res[i] = std::pow(in[i], n);
+    }, 1 << 12);
 
     if (!requiresGrad)
         return out;
 
-    Tensor& a = *this;
-    // Define backward function for backpropagation if needed
-    out._backward = std::make_shared<std::function<void()>>([&a, out, n]() {
+    // Define backward function for backpropagation if needed, it keeps only
+    // pointers to the data it needs
+    std::shared_ptr<double[]> aData = this->data;
+    std::shared_ptr<Tensor> aGrad = this->grad, outGrad = out.grad;
+    out._backward = std::make_shared<std::function<void()>>([aData, aGrad, outGrad, n]() {
         // Power Rule: n * x^(n-1)
-        for (size_t i = 0; i < a.totalSize; ++i) {
-            double localGrad = n * std::pow(a.data[i], n - 1);
-            a.grad->data[i] += out.grad->data[i] * localGrad;
-        }
+        const double * in = aData.get();
+        const double * g = outGrad->data.get();
+        double * grad = aGrad->data.get();
+        parallelFor(aGrad->totalSize, [=](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                grad[i] += g[i] * (n * std::pow(in[i], n - 1));
+        }, 1 << 12);
     });
 
     return out;
 }
 
 Tensor Tensor::exp() {
+    wait();
     Tensor out(this->shape, 0.0);
     bool requiresGrad = this->requiresGrad;
     if (requiresGrad) {
-        std::unordered_set<Tensor, HashFunction> children = {*this};
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {*this};
         out = Tensor(this->shape, 0.0, requiresGrad, operation, children);
     }
 
     // Do the exp operation at data
-    for (size_t i = 0; i < this->totalSize; ++i) {
-        out[i] = std::exp(this->data[i]);
-    }
+    const double * in = this->data.get();
+    double * res = out.data.get();
+    parallelFor(this->totalSize, [=](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            res[i] = std::exp(in[i]);
+    }, 1 << 12);
 
     if (!requiresGrad)
         return out;
 
-    Tensor& a = *this;
-    // Define backward function for backpropagation if needed
-    out._backward = std::make_shared<std::function<void()>>([&a, out]() {
-        for (size_t i = 0; i < a.totalSize; ++i) {
-            a.grad->data[i] += out.data[i] * out.grad->data[i];
+    // Define backward function for backpropagation if needed, it keeps only
+    // pointers to the data it needs
+    std::shared_ptr<double[]> outData = out.data;
+    std::shared_ptr<Tensor> aGrad = this->grad, outGrad = out.grad;
+    out._backward = std::make_shared<std::function<void()>>([outData, aGrad, outGrad]() {
+        const double * out = outData.get();
+        const double * g = outGrad->data.get();
+        double * grad = aGrad->data.get();
+        parallelFor(aGrad->totalSize, [=](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                grad[i] += out[i] * g[i];
+        });
+    });
+
+    return out;
+}
+
+Tensor Tensor::relu() {
+    return activate(Activation::ReLU);
+}
+
+Tensor Tensor::sigmoid() {
+    return activate(Activation::Sigmoid);
+}
+
+Tensor Tensor::tanh() {
+    return activate(Activation::Tanh);
+}
+
+Tensor Tensor::gelu() {
+    return activate(Activation::GELU);
+}
+
+Tensor Tensor::activate(Activation activation) {
+    wait();
+    Tensor out(this->shape, 0.0);
+    bool requiresGrad = this->requiresGrad;
+    if (requiresGrad) {
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {*this};
+        out = Tensor(this->shape, 0.0, requiresGrad, operation, children);
+    }
+
+    // Constants for tanh approximation of GELU
+    const double geluScale = std::sqrt(2.0 / std::numbers::pi);
+    const double geluCubic = 0.044715;
+
+    // Every activation has its own loop, so loops don't contain branches
+    // that would stop vectorization
+    const double * in = this->data.get();
+    double * res = out.data.get();
+    parallelFor(this->totalSize, [=](size_t begin, size_t end) {
+        switch (activation) {
+            case Activation::ReLU:
+                for (size_t i = begin; i < end; i++)
+                    res[i] = in[i] > 0.0 ? in[i] : 0.0;
+                break;
+            case Activation::Sigmoid:
+                for (size_t i = begin; i < end; i++)
+                    res[i] = 1.0 / (1.0 + std::exp(-in[i]));
+                break;
+            case Activation::Tanh:
+                for (size_t i = begin; i < end; i++)
+                    res[i] = std::tanh(in[i]);
+                break;
+            case Activation::GELU:
+                for (size_t i = begin; i < end; i++) {
+                    const double x = in[i];
+                    res[i] = 0.5 * x * (1.0 + std::tanh(geluScale * (x + geluCubic * x * x * x)));
+                }
+                break;
         }
     });
 
+    if (!requiresGrad)
+        return out;
+
+    // Define backward function for backpropagation
+    std::shared_ptr<double[]> aData = this->data, outData = out.data;
+    std::shared_ptr<Tensor> aGrad = this->grad, outGrad = out.grad;
+    out._backward = std::make_shared<std::function<void()>>(
+        [aData, outData, aGrad, outGrad, activation, geluScale, geluCubic]() {
+            const double * x = aData.get();
+            const double * y = outData.get();
+            const double * g = outGrad->data.get();
+            double * grad = aGrad->data.get();
+
+            parallelFor(aGrad->totalSize, [=](size_t begin, size_t end) {
+                switch (activation) {
+                    case Activation::ReLU:
+                        for (size_t i = begin; i < end; i++)
+                            grad[i] += y[i] > 0.0 ? g[i] : 0.0;
+                        break;
+                    case Activation::Sigmoid:
+                        for (size_t i = begin; i < end; i++)
+                            grad[i] += g[i] * y[i] * (1.0 - y[i]);
+                        break;
+                    case Activation::Tanh:
+                        for (size_t i = begin; i < end; i++)
+                            grad[i] += g[i] * (1.0 - y[i] * y[i]);
+                        break;
+                    case Activation::GELU:
+                        for (size_t i = begin; i < end; i++) {
+                            const double t = std::tanh(geluScale * (x[i] + geluCubic * x[i] * x[i] * x[i]));
+                            const double dt = geluScale * (1.0 + 3.0 * geluCubic * x[i] * x[i]);
+                            grad[i] += g[i] * (0.5 * (1.0 + t) + 0.5 * x[i] * (1.0 - t * t) * dt);
+                        }
+                        break;
+                }
+            });
+            aGrad->isGradInit = true;
+        });
+
     return out;
 }
 
-Tensor Tensor::mulmat(Tensor& other) {
-    if (this->shape.size() == 0 || other.shape.size() != this->shape.size())
+Tensor Tensor::softmax() {
+    return softmax(false);
+}
+
+Tensor Tensor::logSoftmax() {
+    return softmax(true);
+}
+
+Tensor Tensor::softmax(bool logarithm) {
+    wait();
+    if (this->totalSize == 0)
         return Tensor({0}, 0.0);
 
-    // Calculate mulmat for 1D tensor (just do dot product)
-    if (this->shape.size() == 1) {
-        double finalProduct = 0.0;
-        for (size_t i = 0; i < this->shape[0]; i++) {
-            finalProduct += this->data[i] * other.data[i];
+    Tensor out(this->shape, 0.0);
+    bool requiresGrad = this->requiresGrad;
+    if (requiresGrad) {
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {*this};
+        out = Tensor(this->shape, 0.0, requiresGrad, operation, children);
+    }
+
+    // Every row of the last dimension is normalized on its own
+    const size_t cols = this->shape.back();
+    const size_t rows = this->totalSize / cols;
+    const double * in = this->data.get();
+    double * res = out.data.get();
+    parallelFor(rows, [=](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            const double * x = in + r * cols;
+            double * y = res + r * cols;
+            const double max = *std::max_element(x, x + cols);
+
+            double sum = 0.0;
+            for (size_t j = 0; j < cols; j++) {
+                y[j] = std::exp(x[j] - max);
+                sum += y[j];
+            }
+
+            if (logarithm) {
+                const double logSum = max + std::log(sum);
+                for (size_t j = 0; j < cols; j++)
+                    y[j] = x[j] - logSum;
+            } else {
+                for (size_t j = 0; j < cols; j++)
+                    y[j] /= sum;
+            }
         }
-        return Tensor({1}, finalProduct);
+    }, (1 << 15) / cols + 1);
+
+    if (!requiresGrad)
+        return out;
+
+    // Define backward function for backpropagation, it needs only output
+    std::shared_ptr<double[]> outData = out.data;
+    std::shared_ptr<Tensor> aGrad = this->grad, outGrad = out.grad;
+    out._backward = std::make_shared<std::function<void()>>(
+        [outData, aGrad, outGrad, rows, cols, logarithm]() {
+            parallelFor(rows, [&](size_t begin, size_t end) {
+                for (size_t r = begin; r < end; r++) {
+                    const double * y = outData.get() + r * cols;
+                    const double * g = outGrad->data.get() + r * cols;
+                    double * grad = aGrad->data.get() + r * cols;
+
+                    if (logarithm) {
+                        // dx = g - softmax * sum(g)
+                        double gSum = 0.0;
+                        for (size_t j = 0; j < cols; j++)
+                            gSum += g[j];
+                        for (size_t j = 0; j < cols; j++)
+                            grad[j] += g[j] - std::exp(y[j]) * gSum;
+                    } else {
+                        // dx = y * (g - sum(g * y))
+                        double gyDot = dotKernel(g, y, cols);
+                        for (size_t j = 0; j < cols; j++)
+                            grad[j] += y[j] * (g[j] - gyDot);
+                    }
+                }
+            }, (1 << 15) / cols + 1);
+            aGrad->isGradInit = true;
+        });
+
+    return out;
+}
+
+Tensor Tensor::crossEntropy(Tensor& logits, Tensor& labels) {
+    logits.wait();
+    labels.wait();
+    if (logits.totalSize == 0)
+        return Tensor({0}, 0.0);
+
+    const size_t cols = logits.shape.back();
+    const size_t rows = logits.totalSize / cols;
+    if (labels.totalSize != rows)
+        return Tensor({0}, 0.0);
+
+    // Labels have to be class indexes, they are copied so backward uses the
+    // same ones even if labels tensor is changed
+    auto classes = std::make_shared<std::vector<size_t>>(rows);
+    for (size_t r = 0; r < rows; r++) {
+        const double label = labels.data[r];
+        if (!(label >= 0.0 && label < (double) cols && label == std::floor(label)))
+            return Tensor({0}, 0.0);
+        (*classes)[r] = (size_t) label;
     }
 
-    // Make shape for result
-    std::vector<size_t> resShape(this->shape);
-    resShape[this->shape.size() - 2] = this->shape[this->shape.size() - 2];
-    resShape[this->shape.size() - 1] = other.shape[this->shape.size() - 1];
+    Tensor result({1}, 0.0);
+    bool requiresGrad = logits.requiresGrad;
+    if (requiresGrad) {
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {logits};
+        result = Tensor({1}, 0.0, requiresGrad, "crossEntropy", children);
+    }
+
+    // Compute softmax and loss of every row in one pass, probabilities are
+    // kept for backward
+    auto probs = std::make_shared<std::vector<double>>(logits.totalSize);
+    std::vector<double> rowLoss(rows);
+    const double * in = logits.data.get();
+    const size_t * label = classes->data();
+    parallelFor(rows, [&](size_t begin, size_t end) {
+        for (size_t r = begin; r < end; r++) {
+            const double * x = in + r * cols;
+            double * p = probs->data() + r * cols;
+            const double max = *std::max_element(x, x + cols);
+
+            double sum = 0.0;
+            for (size_t j = 0; j < cols; j++) {
+                p[j] = std::exp(x[j] - max);
+                sum += p[j];
+            }
+            for (size_t j = 0; j < cols; j++)
+                p[j] /= sum;
+
+            // -log(softmax[label]) = log(sum(exp(x))) - x[label]
+            rowLoss[r] = max + std::log(sum) - x[label[r]];
+        }
+    }, (1 << 15) / cols + 1);
+    result.data[0] = sumKernel(rowLoss.data(), rows) / rows;
+
+    if (!requiresGrad)
+        return result;
+
+    // Gradient of the loss is (softmax - onehot) / rows
+    std::shared_ptr<Tensor> aGrad = logits.grad, resGrad = result.grad;
+    result._backward = std::make_shared<std::function<void()>>(
+        [probs, classes, aGrad, resGrad, rows, cols]() {
+            const double scale = resGrad->data[0] / rows;
+            parallelFor(rows, [&](size_t begin, size_t end) {
+                for (size_t r = begin; r < end; r++) {
+                    const double * p = probs->data() + r * cols;
+                    double * grad = aGrad->data.get() + r * cols;
+                    for (size_t j = 0; j < cols; j++)
+                        grad[j] += p[j] * scale;
+                    grad[(*classes)[r]] -= scale;
+                }
+            }, (1 << 15) / cols + 1);
+            aGrad->isGradInit = true;
+        });
+
+    return result;
+}
+
+Tensor Tensor::mulmat(Tensor& other) {
+    wait();
+    other.wait();
+    const size_t rank = this->shape.size(), otherRank = other.shape.size();
+    if (rank == 0 || otherRank == 0)
+        return Tensor({0}, 0.0);
+
+    // Calculate mulmat for 1D tensor (just do dot product)
+    if (rank == 1 && otherRank == 1)
+        return dot(other);
+
+    // Both tensors have to be at least matrices with matching inner dimension
+    if (rank == 1 || otherRank == 1 || this->shape[rank - 1] != other.shape[otherRank - 2])
+        return Tensor({0}, 0.0);
+
+    // Batch dimensions have to be the same, or one of the tensors is one
+    // matrix (2D or batch dimensions of size 1) used for every batch of the
+    // other one
+    size_t aBatches = 1, bBatches = 1;
+    for (size_t i = 0; i + 2 < rank; i++)
+        aBatches *= this->shape[i];
+    for (size_t i = 0; i + 2 < otherRank; i++)
+        bBatches *= other.shape[i];
+    const bool sameBatches = rank == otherRank
+        && std::equal(this->shape.begin(), this->shape.end() - 2, other.shape.begin());
+    if (!sameBatches && aBatches != 1 && bBatches != 1)
+        return Tensor({0}, 0.0);
+    const bool sharedA = !sameBatches && aBatches == 1;
+    const bool sharedB = !sameBatches && !sharedA;
+
+    // Make shape for result, it has batch dimensions of the batched tensor,
+    // or of the one with higher rank if both are single matrices
+    const bool batchedB = bBatches != 1 || (aBatches == 1 && otherRank > rank);
+    Shape resShape = batchedB ? other.shape : this->shape;
+    const size_t resRank = resShape.size();
+    resShape[resRank - 2] = this->shape[rank - 2];
+    resShape[resRank - 1] = other.shape[otherRank - 1];
     Tensor result(resShape, 0.0);
     bool requiresGrad = this->requiresGrad || other.requiresGrad;
     if (requiresGrad) {
-        std::unordered_set<Tensor, HashFunction> children = {*this, other};
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {*this, other};
         result = Tensor(resShape, 0.0, requiresGrad, operation, children);
     }
 
-    // Make empty shapeIndexes
-    // This will serve as marker
-    // To mark currently calculated batch dimension
-    std::vector<size_t> shapeIndexes;
-    shapeIndexes.resize(this->shape.size());
+    // All batch dimensions are flattened into one, matrices are stored one
+    // after another. Batched tensor times one matrix is one mulmat with all
+    // rows of the batch.
+    const size_t cols = this->shape[rank - 1];
+    const size_t otherCols = other.shape[otherRank - 1];
+    const size_t rows = this->shape[rank - 2] * (sharedB ? aBatches : 1);
+    const size_t batches = sharedA ? bBatches : sharedB ? 1 : aBatches;
 
     // Perform mulmat
-    mulmat(other, result, shapeIndexes, 0);
+    mulmatKernel(this->data.get(), other.data.get(), result.data.get(),
+        batches, rows, cols, otherCols, sharedA);
+
+    if (!requiresGrad)
+        return result;
+
+    // Define one backward function for the whole batch, it keeps only
+    // pointers to the data it needs
+    std::shared_ptr<double[]> aData = this->data, bData = other.data;
+    std::shared_ptr<Tensor> aGrad = this->grad, bGrad = other.grad, resGrad = result.grad;
+    result._backward = std::make_shared<std::function<void()>>(
+        [aData, bData, aGrad, bGrad, resGrad, batches, rows, cols, otherCols, sharedA]() {
+            mulmatBackwardKernel(aData.get(), bData.get(), resGrad->data.get(),
+                aGrad != nullptr ? aGrad->data.get() : nullptr,
+                bGrad != nullptr ? bGrad->data.get() : nullptr,
+                batches, rows, cols, otherCols, sharedA);
+
+            if (aGrad != nullptr)
+                aGrad->isGradInit = true;
+            if (bGrad != nullptr)
+                bGrad->isGradInit = true;
+        });
+
     return result;
 }
 
-void Tensor::mulmat(Tensor& other, Tensor& res, std::vector<size_t>& shapeIndexes, size_t dim) {
-    // Go deeper in batch dimensions till we get to last 2 dims so we can
-    // perform matrix mulmat
-    if (this->shape.size() - 2 != dim) {
-        for (size_t i = 0; i < this->shape[dim]; i++) {
-            shapeIndexes[dim] = i;
-            mulmat(other, res, shapeIndexes, dim + 1);
-        }
-        return;
+Tensor Tensor::dot(Tensor& other) {
+    wait();
+    other.wait();
+    if (this->totalSize != other.totalSize)
+        return Tensor({0}, 0.0);
+
+    Tensor result({1}, 0.0);
+    bool requiresGrad = this->requiresGrad || other.requiresGrad;
+    if (requiresGrad) {
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {*this, other};
+        result = Tensor({1}, 0.0, requiresGrad, operation, children);
+    }
+
+    result.data[0] = dotKernel(this->data.get(), other.data.get(), this->totalSize);
+
+    if (!requiresGrad)
+        return result;
+
+    // Define backward function for backpropagation
+    std::shared_ptr<double[]> aData = this->data, bData = other.data;
+    std::shared_ptr<Tensor> aGrad = this->grad, bGrad = other.grad, resGrad = result.grad;
+    const size_t size = this->totalSize;
+    result._backward = std::make_shared<std::function<void()>>(
+        [aData, bData, aGrad, bGrad, resGrad, size]() {
+            const double g = resGrad->data[0];
+            parallelFor(size, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    if (aGrad != nullptr)
+                        aGrad->data[i] += g * bData[i];
+                    if (bGrad != nullptr)
+                        bGrad->data[i] += g * aData[i];
+                }
+            });
+
+            if (aGrad != nullptr)
+                aGrad->isGradInit = true;
+            if (bGrad != nullptr)
+                bGrad->isGradInit = true;
+        });
+
+    return result;
+}
+
+double Tensor::dotKernel(const double * a, const double * b, size_t size) {
+    // Use independent accumulators, so additions don't wait for each other
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
     }
+    for (; i < size; i++)
+        s0 += a[i] * b[i];
 
-    // Calculate the base offset in memory to get the data we need (last two
-    // dimensions, offset by specific indexes in previous dimensions)
-    size_t baseIndex = getMemoryOffset(shapeIndexes, *this);
-    size_t otherBaseIndex = getMemoryOffset(shapeIndexes, other);
-    size_t resBaseIndex = getMemoryOffset(shapeIndexes, res);
+    return (s0 + s1) + (s2 + s3);
+}
 
-    // Calculate mulmat
-    size_t rows = this->shape[this->shape.size() - 2];
-    size_t cols = this->shape[this->shape.size() - 1];
-    size_t otherCols = other.shape[other.shape.size() - 1];
+namespace {
+/**
+ * Matrix-vector product for matrices with small compile time known number of
+ * columns, so the inner loop is fully unrolled.
+ */
+template <size_t K>
+void gemvFixedCols(const double * a, const double * x, double * res, size_t rows) {
     for (size_t i = 0; i < rows; i++) {
-        for (size_t j = 0; j < otherCols; j++) {
-            for (size_t k = 0; k < cols; k++) {
-                res.data[resBaseIndex + i * otherCols + j] +=
-                    this->data[baseIndex + i * cols + k] *
-                    other.data[otherBaseIndex + k * otherCols + j];
-            }
+        double sum = 0.0;
+        for (size_t k = 0; k < K; k++)
+            sum += a[i * K + k] * x[k];
+        res[i] += sum;
+    }
+}
+}
+
+void Tensor::gemvKernel(const double * a, const double * x, double * res,
+    size_t rows, size_t cols)
+{
+    // Product with no columns is zero, result stays as it is
+    if (rows * cols == 0)
+        return;
+
+    parallelFor(rows, [=](size_t begin, size_t end) {
+        const double * aRows = a + begin * cols;
+        double * resRows = res + begin;
+        const size_t count = end - begin;
+
+        // Tall and narrow matrices are common (e.g. features x weights), use
+        // specialized kernels for them
+        switch (cols) {
+            case 1: gemvFixedCols<1>(aRows, x, resRows, count); break;
+            case 2: gemvFixedCols<2>(aRows, x, resRows, count); break;
+            case 3: gemvFixedCols<3>(aRows, x, resRows, count); break;
+            case 4: gemvFixedCols<4>(aRows, x, resRows, count); break;
+            default:
+                for (size_t i = 0; i < count; i++)
+                    resRows[i] += dotKernel(aRows + i * cols, x, cols);
         }
+    }, (1 << 15) / cols + 1);
+}
+
+void Tensor::gemvBackwardKernel(const double * a, const double * x, const double * g,
+    double * aGrad, double * xGrad, size_t rows, size_t cols)
+{
+    if (rows * cols == 0)
+        return;
+
+    // dA = g * x^T, every row is independent
+    if (aGrad != nullptr) {
+        parallelFor(rows, [=](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                for (size_t k = 0; k < cols; k++)
+                    aGrad[i * cols + k] += g[i] * x[k];
+        }, (1 << 15) / cols + 1);
     }
 
-    if (!requiresGrad)
+    if (xGrad == nullptr)
+        return;
+
+    // dx = A^T * g, sum rows in fixed blocks, so result doesn't depend on
+    // number of threads
+    const size_t blockRows = std::max<size_t>(1, (1 << 14) / cols);
+    const size_t blocks = (rows + blockRows - 1) / blockRows;
+    std::vector<double> partial(blocks * cols, 0.0);
+    parallelFor(blocks, [&](size_t begin, size_t end) {
+        for (size_t block = begin; block < end; block++) {
+            double * sum = partial.data() + block * cols;
+            const size_t last = std::min(rows, (block + 1) * blockRows);
+            for (size_t i = block * blockRows; i < last; i++)
+                for (size_t k = 0; k < cols; k++)
+                    sum[k] += g[i] * a[i * cols + k];
+        }
+    }, 1);
+
+    for (size_t block = 0; block < blocks; block++)
+        for (size_t k = 0; k < cols; k++)
+            xGrad[k] += partial[block * cols + k];
+}
+
+void Tensor::mulmatKernel(const double * a, const double * b, double * res,
+    size_t batches, size_t rows, size_t cols, size_t otherCols, bool sharedA)
+{
+    // Empty matrices give empty or zero result
+    if (batches * rows * cols * otherCols == 0)
         return;
 
-    // If no previous backward function is found, let it be empty function
-    std::function<void()> prevBackFunc = []() {};
-    // Get previous backward function to use later
-    if (res._backward != nullptr)
-        prevBackFunc = *res._backward;
+    // Shared matrix is read by every batch
+    const size_t aStride = sharedA ? 0 : rows * cols;
 
-    // Define backward function for backpropagation if needed
-    Tensor& a = *this;
-    res._backward = std::make_shared<std::function<void()>>(
-        [prevBackFunc, &a, other, res, rows, cols, otherCols, baseIndex, resBaseIndex, otherBaseIndex]() {
+    // Matrix-vector products have their own kernel
+    if (otherCols == 1) {
+        for (size_t batch = 0; batch < batches; batch++)
+            gemvKernel(a + batch * aStride, b + batch * cols, res + batch * rows,
+                rows, cols);
+        return;
+    }
+
+    const size_t minChunk = (1 << 15) / (rows * cols * otherCols) + 1;
+    parallelFor(batches, [=](size_t begin, size_t end) {
+        for (size_t batch = begin; batch < end; batch++) {
+            const double * aMat = a + batch * aStride;
+            const double * bMat = b + batch * cols * otherCols;
+            double * resMat = res + batch * rows * otherCols;
+
+            // Go through rows of b in the inner loop, so memory is accessed
+            // sequentially
             for (size_t i = 0; i < rows; i++) {
-                for (size_t j = 0; j < otherCols; j++) {
-                    for (size_t k = 0; k < cols; k++) {
-                        a.grad->data[baseIndex + i * cols + k] +=
-                            res.grad->data[resBaseIndex + i * otherCols + j] *
-                            other.data[otherBaseIndex + k * otherCols + j];
-                        other.grad->data[otherBaseIndex + k * otherCols + j] +=
-                            a.data[baseIndex + i * cols + k] *
-                            res.grad->data[resBaseIndex + i * otherCols + j];
-                    }
+                for (size_t k = 0; k < cols; k++) {
+                    const double aik = aMat[i * cols + k];
+                    for (size_t j = 0; j < otherCols; j++)
+                        resMat[i * otherCols + j] += aik * bMat[k * otherCols + j];
                 }
             }
-            a.grad->isGradInit = true;
-            other.grad->isGradInit = true;
-
-            // Execute previously defined backward function.
-            // Because we go through batch dimensions recursively we have to
-            // chain backward functions like this.
-            prevBackFunc();
-        });
+        }
+    }, minChunk);
 }
 
-size_t Tensor::getMemoryOffset(std::vector<size_t> shapeIndexes, const Tensor& t) {
-    size_t baseIndex = 0;
-    for (size_t i = 0; i < shapeIndexes.size() - 2; i++) {
-        const size_t dim = shapeIndexes[i];
-        size_t nextSizes = 1;
-        for (size_t j = i + 1; j < t.shape.size(); j++) {
-            nextSizes *= t.shape[j];
-        }
-        baseIndex += dim * nextSizes;
+void Tensor::mulmatBackwardKernel(const double * a, const double * b, const double * g,
+    double * aGrad, double * bGrad, size_t batches, size_t rows, size_t cols, size_t otherCols,
+    bool sharedA)
+{
+    // Empty matrices have nothing to add to gradients
+    if (batches * rows * cols * otherCols == 0)
+        return;
+
+    const size_t aStride = sharedA ? 0 : rows * cols;
+
+    if (otherCols == 1) {
+        for (size_t batch = 0; batch < batches; batch++)
+            gemvBackwardKernel(a + batch * aStride, b + batch * cols, g + batch * rows,
+                aGrad != nullptr ? aGrad + batch * aStride : nullptr,
+                bGrad != nullptr ? bGrad + batch * cols : nullptr,
+                rows, cols);
+        return;
+    }
+
+    // Gradient of shared matrix is summed over batches one after another,
+    // so batches don't write to the same memory
+    if (sharedA && aGrad != nullptr) {
+        for (size_t batch = 0; batch < batches; batch++)
+            mulmatBackwardKernel(a, b + batch * cols * otherCols, g + batch * rows * otherCols,
+                aGrad, nullptr, 1, rows, cols, otherCols);
+        aGrad = nullptr;
     }
-    return baseIndex;
+
+    const size_t minChunk = (1 << 15) / (rows * cols * otherCols) + 1;
+    parallelFor(batches, [=](size_t begin, size_t end) {
+        for (size_t batch = begin; batch < end; batch++) {
+            const double * aMat = a + batch * aStride;
+            const double * bMat = b + batch * cols * otherCols;
+            const double * gMat = g + batch * rows * otherCols;
+
+            for (size_t i = 0; i < rows; i++) {
+                for (size_t k = 0; k < cols; k++) {
+                    const double * gRow = gMat + i * otherCols;
+                    const double * bRow = bMat + k * otherCols;
+                    // dA = dRes * B^T
+                    if (aGrad != nullptr)
+                        aGrad[batch * aStride + i * cols + k] +=
+                            dotKernel(gRow, bRow, otherCols);
+                    // dB = A^T * dRes
+                    if (bGrad != nullptr) {
+                        const double aik = aMat[i * cols + k];
+                        double * bGradRow = bGrad + batch * cols * otherCols + k * otherCols;
+                        for (size_t j = 0; j < otherCols; j++)
+                            bGradRow[j] += aik * gRow[j];
+                    }
+                }
+            }
+        }
+    }, minChunk);
 }
 
 bool Tensor::operator==(const Tensor& other) const {
+    if (this->pending != nullptr || other.pending != nullptr)
+        return resolved() == other.resolved();
     if (this->compareShape(other) == false) return false;
 
-    for (size_t i = 0; this->totalSize; i++) {
+    for (size_t i = 0; i < this->totalSize; i++) {
         if (this->data[i] != other.data[i]) {
             return false;
         }
@@ -387,75 +1036,159 @@ Tensor operator/(Tensor& other, const double number) {
     return Tensor::tensorsOperations(other, number, "/");
 }
 
+namespace {
+/**
+ * Compute shape of the result of broadcast operation. Dimensions are aligned
+ * from the end, dimension of size 1 (or missing one) is repeated.
+ * @param a Shape of the first operand
+ * @param b Shape of the second operand
+ * @param result Shape of the result
+ * @return false if shapes can't be broadcast
+ */
+bool broadcastShape(const Shape& a, const Shape& b, Shape& result) {
+    const size_t rank = std::max(a.size(), b.size());
+    // Start from the longer shape, so the result has the right rank
+    Shape dims = a.size() >= b.size() ? a : b;
+    for (size_t i = 0; i < rank; i++) {
+        const size_t aDim = i < a.size() ? a[a.size() - 1 - i] : 1;
+        const size_t bDim = i < b.size() ? b[b.size() - 1 - i] : 1;
+        if (aDim != bDim && aDim != 1 && bDim != 1)
+            return false;
+        dims[rank - 1 - i] = aDim == 1 ? bDim : aDim;
+    }
+    result = dims;
+    return true;
+}
+
+/**
+ * Maps index of the result of broadcast operation to index of an operand
+ */
+struct BroadcastIndex {
+    // Operand has the same size as result (step 1) or one element (step 0)
+    bool general;
+    size_t step;
+    // Shape of the result and strides of the operand, 0 along repeated dimensions
+    Shape resShape;
+    Shape strides;
+
+    BroadcastIndex(const Shape& shape, size_t size, const Shape& resShape, size_t resSize)
+        :general(size != resSize && size != 1), step(size == resSize ? 1 : 0),
+        resShape(resShape), strides(resShape)
+    {
+        size_t stride = 1;
+        for (size_t i = resShape.size(); i-- > 0;) {
+            const size_t offset = resShape.size() - i;
+            const size_t dim = offset <= shape.size() ? shape[shape.size() - offset] : 1;
+            this->strides[i] = dim == 1 ? 0 : stride;
+            stride *= dim;
+        }
+    }
+
+    size_t operator()(size_t index) const {
+        if (!this->general)
+            return index * this->step;
+        size_t result = 0;
+        for (size_t i = this->resShape.size(); i-- > 0;) {
+            result += index % this->resShape[i] * this->strides[i];
+            index /= this->resShape[i];
+        }
+        return result;
+    }
+};
+}
+
 Tensor Tensor::tensorsOperations(Tensor& a, Tensor& b, std::string operation) {
-    bool isScalar = a.totalSize == 1 || b.totalSize == 1;
-    auto resShape = a.shape;
-    if (isScalar && a.totalSize == 1)
+    a.wait();
+    b.wait();
+    // Tensor with one element keeps shape of the other one, other shapes are
+    // broadcast
+    Shape resShape = a.shape;
+    bool compatible = true;
+    if (a.totalSize == 1)
         resShape = b.shape;
+    else if (b.totalSize != 1)
+        compatible = broadcastShape(a.shape, b.shape, resShape);
+    if (!compatible)
+        resShape = a.shape;
 
     Tensor result(resShape, 0.0);
     bool requiresGrad = a.requiresGrad || b.requiresGrad;
     if (requiresGrad) {
-        std::unordered_set<Tensor, HashFunction> children = {a, b};
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {a, b};
         result = Tensor(resShape, 0.0, requiresGrad, operation, children);
     }
 
-    if (a.compareShape(b) == false && !isScalar)
+    if (!compatible || (operation != "+" && operation != "*"))
         return result;
 
-    std::unordered_map<std::string, std::function<double(double, double)>> operationMap{
-        {"+", [](double a, double b) {return a + b;}},
-        {"*", [](double a, double b) {return a * b;}},
-    };
-
-    Tensor& scalar = a;
-    Tensor& t = b;
-    if (isScalar && b.totalSize == 1) {
-        t = a;
-        scalar = b;
-    }
-
-    // Do basic math operation between tensors
-    if (operationMap.find(operation) != operationMap.end()) {
-        for (size_t i = 0; i < t.totalSize; i++) {
-            if (!isScalar)
-                result.data[i] = operationMap.at(operation)(a.data[i], b.data[i]);
-            else
-                result.data[i] = operationMap.at(operation)(t[i], scalar[0]);
+    const size_t size = result.totalSize;
+    const BroadcastIndex aIndex(a.shape, a.totalSize, resShape, size);
+    const BroadcastIndex bIndex(b.shape, b.totalSize, resShape, size);
+    const bool multiply = operation == "*";
+
+    // Do basic math operation between tensors, simple broadcast (same size
+    // or one element) has its own loop without index mapping
+    const double * aIn = a.data.get();
+    const double * bIn = b.data.get();
+    double * out = result.data.get();
+    parallelFor(size, [=](size_t begin, size_t end) {
+        if (!aIndex.general && !bIndex.general) {
+            const size_t aStep = aIndex.step, bStep = bIndex.step;
+            for (size_t i = begin; i < end; i++)
+                out[i] = multiply ? aIn[i * aStep] * bIn[i * bStep] : aIn[i * aStep] + bIn[i * bStep];
+        } else {
+            for (size_t i = begin; i < end; i++) {
+                const double x = aIn[aIndex(i)], y = bIn[bIndex(i)];
+                out[i] = multiply ? x * y : x + y;
+            }
         }
-    }
+    });
 
     if (!requiresGrad)
         return result;
 
-    // Define backward function for calculating gradient if needed
-    result._backward = std::make_shared<std::function<void()>>([operationMap, operation, &result, a, b, t, scalar, isScalar]() {
-        for (size_t i = 0; i < result.grad->totalSize; i++) {
-            if (operation == "*") {
-                if (!isScalar) {
-                    a.grad->data[i] += result.grad->data[i] * b.data[i];
-                    b.grad->data[i] += result.grad->data[i] * a.data[i];
-                } else {
-                    t.grad->data[i] += result.grad->data[i] * scalar.data[0];
-                    scalar.grad->data[i] += result.grad->data[i] * t.data[i];
+    // Define backward function for calculating gradient if needed, operand
+    // without gradient is skipped
+    std::shared_ptr<double[]> aData = a.data, bData = b.data;
+    std::shared_ptr<Tensor> aGrad = a.grad, bGrad = b.grad, resGrad = result.grad;
+    result._backward = std::make_shared<std::function<void()>>(
+        [aData, bData, aGrad, bGrad, resGrad, size, aIndex, bIndex, multiply]() {
+            const double * g = resGrad->data.get();
+            auto accumulate = [=](double * grad, const double * other,
+                const BroadcastIndex& index, const BroadcastIndex& otherIndex)
+            {
+                // Gradient of repeated values is summed on one thread
+                if (index.general || index.step == 0) {
+                    for (size_t i = 0; i < size; i++)
+                        grad[index(i)] += multiply ? g[i] * other[otherIndex(i)] : g[i];
+                    return;
                 }
-            } else if (operation == "+") {
-                a.grad->data[i] += result.grad->data[i];
-                b.grad->data[i] += result.grad->data[i];
-            }
-        }
-        a.grad->isGradInit = true;
-        b.grad->isGradInit = true;
-    });
+                parallelFor(size, [=](size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; i++)
+                        grad[i] += multiply ? g[i] * other[otherIndex(i)] : g[i];
+                });
+            };
+
+            if (aGrad != nullptr)
+                accumulate(aGrad->data.get(), bData.get(), aIndex, bIndex);
+            if (bGrad != nullptr)
+                accumulate(bGrad->data.get(), aData.get(), bIndex, aIndex);
+
+            if (aGrad != nullptr)
+                aGrad->isGradInit = true;
+            if (bGrad != nullptr)
+                bGrad->isGradInit = true;
+        });
 
     return result;
 }
 
 Tensor Tensor::tensorsOperations(Tensor& a, double number, std::string operation) {
+    a.wait();
     Tensor result(a.shape, 0.0);
     bool requiresGrad = a.requiresGrad;
     if (requiresGrad) {
-        std::unordered_set<Tensor, HashFunction> children = {a};
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {a};
         result = Tensor(a.shape, 0.0, requiresGrad, operation, children);
     }
 
@@ -474,29 +1207,41 @@ Tensor Tensor::tensorsOperations(Tensor& a, double number, std::string operation
     };
 
     // Do basic math operations
-    if (operationMap.find(operation) != operationMap.end())
-        for (size_t i = 0; i < a.totalSize; i++)
-            result.data[i] = operationMap.at(operation)(a.data[i], number);
+    if (operationMap.find(operation) == operationMap.end())
+        return result;
+    const std::function<double(double, double)> op = operationMap.at(operation);
+    const double * in = a.data.get();
+    double * out = result.data.get();
+    parallelFor(a.totalSize, [=, &op](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            out[i] = op(in[i], number);
+    });
 
     if (!requiresGrad)
         return result;
 
     // Define backward function for calculating gradient if needed
-    result._backward = std::make_shared<std::function<void()>>([gradOpMap, operation, result, a, number]() {
-        for (size_t i = 0; i < result.grad->totalSize; i++) {
-            a.grad->data[i] += gradOpMap.at(operation)(result.grad->data[i], number);
-        }
-        a.grad->isGradInit = true;
+    std::shared_ptr<Tensor> aGrad = a.grad, resGrad = result.grad;
+    const std::function<double(double, double)> gradOp = gradOpMap.at(operation);
+    result._backward = std::make_shared<std::function<void()>>([gradOp, aGrad, resGrad, number]() {
+        const double * g = resGrad->data.get();
+        double * grad = aGrad->data.get();
+        parallelFor(resGrad->totalSize, [=, &gradOp](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                grad[i] += gradOp(g[i], number);
+        });
+        aGrad->isGradInit = true;
     });
 
     return result;
 }
 
 Tensor Tensor::tensorsOperations(double number, Tensor& a, std::string operation) {
+    a.wait();
     Tensor result(a.shape, 0.0);
     bool requiresGrad = a.requiresGrad;
     if (requiresGrad) {
-        std::unordered_set<Tensor, HashFunction> children = {a};
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {a};
         result = Tensor(a.shape, 0.0, requiresGrad, operation, children);
     }
 
@@ -519,189 +1264,623 @@ Tensor Tensor::tensorsOperations(double number, Tensor& a, std::string operation
     };
 
     // Do basic math operations
-    if (operationMap.find(operation) != operationMap.end())
-        for (size_t i = 0; i < a.totalSize; i++)
-            result.data[i] = operationMap.at(operation)(number, a.data[i]);
+    if (operationMap.find(operation) == operationMap.end())
+        return result;
+    const std::function<double(double, double)> op = operationMap.at(operation);
+    const double * in = a.data.get();
+    double * out = result.data.get();
+    parallelFor(a.totalSize, [=, &op](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++)
+            out[i] = op(number, in[i]);
+    });
 
     if (!requiresGrad)
         return result;
 
     // Define backward function for calculating gradient if needed
-    result._backward = std::make_shared<std::function<void()>>([gradOpMap, operation, &result, a, number]() {
-        for (size_t i = 0; i < result.grad->totalSize; i++) {
-            a.grad->data[i] += gradOpMap.at(operation)(result.grad->data[i], number, a.data[i]);
-        }
-        a.grad->isGradInit = true;
+    std::shared_ptr<double[]> aData = a.data;
+    std::shared_ptr<Tensor> aGrad = a.grad, resGrad = result.grad;
+    const std::function<double(double, double, double)> gradOp = gradOpMap.at(operation);
+    result._backward = std::make_shared<std::function<void()>>([gradOp, aData, aGrad, resGrad, number]() {
+        const double * g = resGrad->data.get();
+        const double * in = aData.get();
+        double * grad = aGrad->data.get();
+        parallelFor(resGrad->totalSize, [=, &gradOp](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                grad[i] += gradOp(g[i], number, in[i]);
+        });
+        aGrad->isGradInit = true;
     });
 
     return result;
 }
 
+namespace {
+/**
+ * Sum array by splitting it in halves, error grows with log of size instead
+ * of size. Short arrays are summed with independent accumulators.
+ */
+double pairwiseSum(const double * data, size_t size) {
+    if (size <= 256) {
+        double acc[8] = {};
+        size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+            for (size_t j = 0; j < 8; j++)
+                acc[j] += data[i + j];
+        for (; i < size; i++)
+            acc[0] += data[i];
+
+        return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+    }
+
+    // Split at multiple of 8, so leaves stay aligned to accumulators
+    const size_t half = (size / 2 + 7) / 8 * 8;
+    return pairwiseSum(data, half) + pairwiseSum(data + half, size - half);
+}
+
+/**
+ * Find max (or min) value of an array. Written without branches, so it can be
+ * vectorized.
+ */
+double extremumValue(const double * data, size_t size, bool findMax) {
+    double acc[4] = {data[0], data[0], data[0], data[0]};
+    size_t i = 0;
+    if (findMax) {
+        for (; i + 4 <= size; i += 4)
+            for (size_t j = 0; j < 4; j++)
+                acc[j] = data[i + j] > acc[j] ? data[i + j] : acc[j];
+        for (; i < size; i++)
+            acc[0] = data[i] > acc[0] ? data[i] : acc[0];
+        return std::max(std::max(acc[0], acc[1]), std::max(acc[2], acc[3]));
+    }
+
+    for (; i + 4 <= size; i += 4)
+        for (size_t j = 0; j < 4; j++)
+            acc[j] = data[i + j] < acc[j] ? data[i + j] : acc[j];
+    for (; i < size; i++)
+        acc[0] = data[i] < acc[0] ? data[i] : acc[0];
+    return std::min(std::min(acc[0], acc[1]), std::min(acc[2], acc[3]));
+}
+}
+
 Tensor Tensor::mean() {
+    wait();
     Tensor result({1}, 0.0);
     bool requiresGrad = this->requiresGrad;
     if (requiresGrad) {
-        std::unordered_set<Tensor, HashFunction> children = {*this};
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {*this};
         result = Tensor({1}, 0.0, requiresGrad, operation, children);
     }
 
     // Calculate mean and save it to result tensor
-    double sum = 0;
-    for (size_t i = 0; i < this->totalSize; i++)
-        sum += this->data[i];
-    result.data[0] = sum / this->totalSize;
+    result.data[0] = sumKernel(this->data.get(), this->totalSize) / this->totalSize;
 
     if (!requiresGrad)
         return result;
 
     // Add backward function for backward propagation
-    Tensor& a = *this;
-    result._backward = std::make_shared<std::function<void()>>([&a, &result]() {
-        double n = (double) a.totalSize;
-
-        for (size_t i = 0; i < a.grad->totalSize; i++) {
-            a.grad->data[i] += result.grad->data[0] * (1.0 / n);
-        }
-        a.grad->isGradInit = true;
+    std::shared_ptr<Tensor> aGrad = this->grad, resGrad = result.grad;
+    result._backward = std::make_shared<std::function<void()>>([aGrad, resGrad]() {
+        const double g = resGrad->data[0] / aGrad->totalSize;
+        parallelFor(aGrad->totalSize, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                aGrad->data[i] += g;
+        });
+        aGrad->isGradInit = true;
     });
 
     return result;
 }
 
 Tensor Tensor::max() {
+    wait();
+    if (this->totalSize == 0)
+        return Tensor({0}, 0.0);
+
     Tensor result({1}, 0.0);
     bool requiresGrad = this->requiresGrad;
     if (requiresGrad) {
-        std::unordered_set<Tensor, HashFunction> children = {*this};
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {*this};
         result = Tensor({1}, 0.0, requiresGrad, operation, children);
     }
 
     // Find max and save it to the result tensor
-    double max = this->data[0];
-    size_t maxIndex = 0;
-    for (size_t i = 1; i < this->totalSize; i++) {
-        if (this->data[i] > max) {
-            max = this->data[i];
-            maxIndex = i;
-        }
-    }
-    result.data[0] = max;
+    size_t maxIndex = extremumKernel(this->data.get(), this->totalSize, true);
+    result.data[0] = this->data[maxIndex];
 
     if (!requiresGrad)
         return result;
 
     // Add backward function for backward propagation
-    Tensor& a = *this;
-    result._backward = std::make_shared<std::function<void()>>([&a, &result, maxIndex]() {
+    std::shared_ptr<Tensor> aGrad = this->grad, resGrad = result.grad;
+    result._backward = std::make_shared<std::function<void()>>([aGrad, resGrad, maxIndex]() {
         // Only max element gets gradient update
-        a.grad->data[maxIndex] += result.grad->data[0];
-        a.grad->isGradInit = true;
+        aGrad->data[maxIndex] += resGrad->data[0];
+        aGrad->isGradInit = true;
     });
 
     return result;
 }
 
 Tensor Tensor::min() {
+    wait();
+    if (this->totalSize == 0)
+        return Tensor({0}, 0.0);
+
     Tensor result({1}, 0.0);
     bool requiresGrad = this->requiresGrad;
     if (requiresGrad) {
-        std::unordered_set<Tensor, HashFunction> children = {*this};
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {*this};
         result = Tensor({1}, 0.0, requiresGrad, operation, children);
     }
 
     // Find min and save it to the result tensor
-    double min = this->data[0];
-    size_t minIndex = 0;
-    for (size_t i = 1; i < this->totalSize; i++) {
-        if (this->data[i] < min) {
-            min = this->data[i];
-            minIndex = i;
-        }
-    }
-    result.data[0] = min;
+    size_t minIndex = extremumKernel(this->data.get(), this->totalSize, false);
+    result.data[0] = this->data[minIndex];
 
     if (!requiresGrad)
         return result;
 
     // Add backward function for backward propagation
-    Tensor& a = *this;
-    result._backward = std::make_shared<std::function<void()>>([&a, &result, minIndex]() {
+    std::shared_ptr<Tensor> aGrad = this->grad, resGrad = result.grad;
+    result._backward = std::make_shared<std::function<void()>>([aGrad, resGrad, minIndex]() {
         // Only min element gets gradient update
-        a.grad->data[minIndex] += result.grad->data[0];
-        a.grad->isGradInit = true;
+        aGrad->data[minIndex] += resGrad->data[0];
+        aGrad->isGradInit = true;
     });
 
     return result;
 }
 
 Tensor Tensor::sum() {
+    wait();
     Tensor result({1}, 0.0);
     bool requiresGrad = this->requiresGrad;
     if (requiresGrad) {
-        std::unordered_set<Tensor, HashFunction> children = {*this};
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {*this};
         result = Tensor({1}, 0.0, requiresGrad, operation, children);
     }
 
     // Calculate sum and save it to result tensor
-    double sum = 0;
-    for (size_t i = 0; i < this->totalSize; i++)
-        sum += this->data[i];
-    result.data[0] = sum;
+    result.data[0] = sumKernel(this->data.get(), this->totalSize);
 
     if (!requiresGrad)
         return result;
 
     // Add backward function for backward propagation
-    Tensor& a = *this;
-    result._backward = std::make_shared<std::function<void()>>([&a, &result]() {
-        for (size_t i = 0; i < a.grad->totalSize; i++) {
-            a.grad->data[i] += result.grad->data[0];
-        }
-        a.grad->isGradInit = true;
+    std::shared_ptr<Tensor> aGrad = this->grad, resGrad = result.grad;
+    result._backward = std::make_shared<std::function<void()>>([aGrad, resGrad]() {
+        const double g = resGrad->data[0];
+        parallelFor(aGrad->totalSize, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                aGrad->data[i] += g;
+        });
+        aGrad->isGradInit = true;
     });
 
     return result;
 }
 
+Tensor Tensor::sum(size_t axis, bool keepdim) {
+    return reduceAxis(axis, keepdim, Reduction::Sum);
+}
+
+Tensor Tensor::mean(size_t axis, bool keepdim) {
+    return reduceAxis(axis, keepdim, Reduction::Mean);
+}
+
+Tensor Tensor::max(size_t axis, bool keepdim) {
+    return reduceAxis(axis, keepdim, Reduction::Max);
+}
+
+Tensor Tensor::min(size_t axis, bool keepdim) {
+    return reduceAxis(axis, keepdim, Reduction::Min);
+}
+
+Tensor Tensor::argmax(size_t axis, bool keepdim) {
+    return reduceAxis(axis, keepdim, Reduction::ArgMax);
+}
+
+Tensor Tensor::argmin(size_t axis, bool keepdim) {
+    return reduceAxis(axis, keepdim, Reduction::ArgMin);
+}
+
+Tensor Tensor::reduceAxis(size_t axis, bool keepdim, Reduction reduction) {
+    wait();
+    if (axis >= this->shape.size())
+        return Tensor({0}, 0.0);
+
+    // Sum of empty axis is zero, other reductions of it have no value
+    const size_t axisSize = this->shape[axis];
+    if (axisSize == 0 && reduction != Reduction::Sum)
+        return Tensor({0}, 0.0);
+
+    // Make shape for result
+    std::vector<size_t> resDims;
+    for (size_t i = 0; i < this->shape.size(); i++) {
+        if (i != axis)
+            resDims.push_back(this->shape[i]);
+        else if (keepdim)
+            resDims.push_back(1);
+    }
+    if (resDims.empty())
+        resDims.push_back(1);
+
+    Tensor result(resDims, 0.0);
+    bool isIndex = reduction == Reduction::ArgMax || reduction == Reduction::ArgMin;
+    bool requiresGrad = this->requiresGrad && !isIndex;
+    if (requiresGrad) {
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {*this};
+        result = Tensor(resDims, 0.0, requiresGrad, operation, children);
+    }
+
+    // Empty tensor gives empty result or zero sums, nothing flows back
+    if (this->totalSize == 0)
+        return result;
+
+    // Look at the tensor as [outer, axisSize, inner], values along axis are
+    // inner elements apart
+    const size_t inner = this->strides[axis];
+    const size_t outer = this->totalSize / (axisSize * inner);
+    const double * in = this->data.get();
+    double * out = result.data.get();
+
+    // Indexes of max/min values, they are needed for backward
+    auto indexes = std::make_shared<std::vector<size_t>>();
+    bool isExtremum = reduction != Reduction::Sum && reduction != Reduction::Mean;
+    if (isExtremum)
+        indexes->resize(outer * inner);
+
+    parallelFor(outer, [&](size_t begin, size_t end) {
+        for (size_t o = begin; o < end; o++) {
+            const double * slice = in + o * axisSize * inner;
+            double * outRow = out + o * inner;
+
+            if (!isExtremum) {
+                // Whole row is contiguous, or go through slice row by row, so
+                // memory is accessed sequentially
+                if (inner == 1) {
+                    outRow[0] = pairwiseSum(slice, axisSize);
+                } else {
+                    for (size_t a = 0; a < axisSize; a++)
+                        for (size_t i = 0; i < inner; i++)
+                            outRow[i] += slice[a * inner + i];
+                }
+
+                if (reduction == Reduction::Mean)
+                    for (size_t i = 0; i < inner; i++)
+                        outRow[i] /= axisSize;
+                continue;
+            }
+
+            bool findMax = reduction == Reduction::Max || reduction == Reduction::ArgMax;
+            size_t * index = indexes->data() + o * inner;
+            for (size_t i = 0; i < inner; i++) {
+                outRow[i] = slice[i];
+                index[i] = 0;
+            }
+            for (size_t a = 1; a < axisSize; a++) {
+                for (size_t i = 0; i < inner; i++) {
+                    const double value = slice[a * inner + i];
+                    if (findMax ? value > outRow[i] : value < outRow[i]) {
+                        outRow[i] = value;
+                        index[i] = a;
+                    }
+                }
+            }
+
+            if (isIndex)
+                for (size_t i = 0; i < inner; i++)
+                    outRow[i] = (double) index[i];
+        }
+    }, (1 << 15) / (axisSize * inner) + 1);
+
+    if (!requiresGrad)
+        return result;
+
+    // Add backward function for backward propagation
+    std::shared_ptr<Tensor> aGrad = this->grad, resGrad = result.grad;
+    result._backward = std::make_shared<std::function<void()>>(
+        [aGrad, resGrad, indexes, reduction, isExtremum, outer, axisSize, inner]() {
+            const double scale = reduction == Reduction::Mean ? 1.0 / axisSize : 1.0;
+            parallelFor(outer, [&](size_t begin, size_t end) {
+                for (size_t o = begin; o < end; o++) {
+                    double * gradSlice = aGrad->data.get() + o * axisSize * inner;
+                    const double * g = resGrad->data.get() + o * inner;
+
+                    // Only max/min elements get gradient update
+                    if (isExtremum) {
+                        const size_t * index = indexes->data() + o * inner;
+                        for (size_t i = 0; i < inner; i++)
+                            gradSlice[index[i] * inner + i] += g[i];
+                        continue;
+                    }
+
+                    for (size_t a = 0; a < axisSize; a++)
+                        for (size_t i = 0; i < inner; i++)
+                            gradSlice[a * inner + i] += g[i] * scale;
+                }
+            }, (1 << 15) / (axisSize * inner) + 1);
+            aGrad->isGradInit = true;
+        });
+
+    return result;
+}
+
+void Tensor::setDeterministic(bool deterministic) {
+    Tensor::deterministic = deterministic;
+}
+
+double Tensor::sumKernel(const double * data, size_t size) {
+    // Blocks are big enough to be worth of splitting between threads
+    const size_t blockSize = 1 << 13;
+    const size_t blocks = (size + blockSize - 1) / blockSize;
+    if (blocks <= 1)
+        return pairwiseSum(data, size);
+
+    // Fixed blocks are summed in the same order no matter how many threads
+    // are used, so the result is always the same
+    if (deterministic) {
+        std::vector<double> partial(blocks);
+        parallelFor(blocks, [&](size_t begin, size_t end) {
+            for (size_t block = begin; block < end; block++) {
+                const size_t first = block * blockSize;
+                partial[block] = pairwiseSum(data + first, std::min(blockSize, size - first));
+            }
+        }, 4);
+        return pairwiseSum(partial.data(), blocks);
+    }
+
+    // Every thread sums its own chunk, order of chunks depends on scheduling
+    double total = 0.0;
+    std::mutex totalMutex;
+    parallelFor(size, [&](size_t begin, size_t end) {
+        double chunkSum = pairwiseSum(data + begin, end - begin);
+        std::lock_guard<std::mutex> lock(totalMutex);
+        total += chunkSum;
+    });
+    return total;
+}
+
+size_t Tensor::extremumKernel(const double * data, size_t size, bool findMax) {
+    // Find extremum of every block, index is then searched only in the first
+    // block reaching the final value. On equal values first index is used.
+    const size_t blockSize = 1 << 13;
+    const size_t blocks = (size + blockSize - 1) / blockSize;
+    std::vector<double> partial(blocks);
+    parallelFor(blocks, [&](size_t begin, size_t end) {
+        for (size_t block = begin; block < end; block++) {
+            const size_t first = block * blockSize;
+            partial[block] = extremumValue(data + first, std::min(blockSize, size - first), findMax);
+        }
+    }, 4);
+
+    size_t best = 0;
+    for (size_t block = 1; block < blocks; block++) {
+        if (findMax ? partial[block] > partial[best] : partial[block] < partial[best])
+            best = block;
+    }
+
+    const size_t first = best * blockSize;
+    const size_t length = std::min(blockSize, size - first);
+    const double * blockData = data + first;
+    // NaN values are never found, keep first element of the block then
+    size_t offset = std::find(blockData, blockData + length, partial[best]) - blockData;
+    return first + (offset < length ? offset : 0);
+}
+
 void Tensor::backward() {
+    backward(nullptr);
+}
+
+void Tensor::backward(const std::function<void(const Tensor&)>& onGradReady) {
+    wait();
     std::vector<const Tensor*> topo;
-    std::vector<const Tensor*> visited;
+    // Copies of one tensor share gradient, it identifies the node. For every
+    // node count nodes that still add to its gradient.
+    std::unordered_map<const Tensor*, size_t> consumers;
 
     // Find all visited nodes and put all unique nodes to topo
     std::function<void(const Tensor*)> build_topo = [&](const Tensor* v) {
         // Check if already visited this node
-        if (std::find(visited.begin(), visited.end(), v) == visited.end()) {
-            visited.push_back(v);
+        if (consumers.emplace(v->grad.get(), 0).second) {
             for (const Tensor& p : v->prev) {
-                const Tensor * p1 = &p;
-                build_topo(p1);
+                if (p.grad == nullptr)
+                    continue;
+                build_topo(&p);
+                consumers[p.grad.get()]++;
             }
             topo.push_back(v);
         }
     };
     build_topo(this);
 
-    // Set first gradient to 1.0
-    *this->grad = Tensor((std::vector<size_t>) {1}, (double) 1.0);
+    // Set first gradient to 1.0, reuse already allocated gradient if possible
+    if (this->grad == nullptr || this->grad->totalSize != this->totalSize)
+        this->grad = std::make_shared<Tensor>(this->shape, 0.0);
+    std::fill_n(this->grad->data.get(), this->grad->totalSize, 1.0);
     this->grad->isGradInit = true;
 
+    // Independent branches of the graph run in parallel, unless this thread
+    // is already one of parallel workers
+    if (!singleThreaded && ThreadPool::global().getThreadCount() > 0 && topo.size() > 2) {
+        backwardParallel(topo, onGradReady);
+        return;
+    }
+
     // Process nodes in reverse order
     for (auto it = topo.rbegin(); it != topo.rend(); it++) {
         if ((*it)->_backward != nullptr)
             (*(*it)->_backward)();
+
+        if (!onGradReady)
+            continue;
+        for (const Tensor& p : (*it)->prev) {
+            if (p.grad != nullptr && --consumers[p.grad.get()] == 0 && p._backward == nullptr)
+                onGradReady(p);
+        }
     }
 }
 
+void Tensor::backwardParallel(const std::vector<const Tensor*>& topo,
+    const std::function<void(const Tensor&)>& onGradReady)
+{
+    // Nodes are numbered in the order serial backward runs them, root is 0
+    const std::vector<const Tensor*> nodes(topo.rbegin(), topo.rend());
+    const size_t n = nodes.size();
+    std::unordered_map<const Tensor*, size_t> position;
+    for (size_t i = 0; i < n; i++)
+        position[nodes[i]->grad.get()] = i;
+
+    // For every node find its children and nodes writing to its gradient,
+    // head is number of writers that are already done
+    std::vector<std::vector<size_t>> children(n), writers(n);
+    std::vector<size_t> head(n, 0);
+    for (size_t i = 0; i < n; i++) {
+        for (const Tensor& p : nodes[i]->prev) {
+            if (p.grad == nullptr)
+                continue;
+            const size_t child = position.at(p.grad.get());
+            children[i].push_back(child);
+            writers[child].push_back(i);
+        }
+    }
+
+    ThreadPool& pool = ThreadPool::global();
+    std::mutex mutex;
+    std::vector<bool> started(n, false);
+    std::atomic<size_t> remaining = n;
+    // First exception of a node, nodes after it are only counted as done
+    std::exception_ptr error;
+    std::atomic<bool> failed = false;
+
+    // Node can start when its gradient is complete and it is the next one
+    // writing to gradients of all its children, called under the lock
+    auto canStart = [&](size_t i) {
+        if (started[i] || head[i] != writers[i].size())
+            return false;
+        for (size_t child : children[i]) {
+            if (writers[child][head[child]] != i)
+                return false;
+        }
+        return true;
+    };
+
+    std::function<void(size_t)> run = [&](size_t first) {
+        std::vector<size_t> work = {first};
+        while (!work.empty()) {
+            const size_t i = work.back();
+            work.pop_back();
+            if (!failed.load(std::memory_order_relaxed)) {
+                try {
+                    if (nodes[i]->_backward != nullptr)
+                        (*nodes[i]->_backward)();
+                    else if (onGradReady && !writers[i].empty())
+                        onGradReady(*nodes[i]);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (error == nullptr)
+                        error = std::current_exception();
+                    failed.store(true, std::memory_order_relaxed);
+                }
+            }
+
+            // Collect nodes that can start now
+            std::vector<size_t> next;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (size_t child : children[i])
+                    head[child]++;
+                for (size_t child : children[i]) {
+                    if (canStart(child)) {
+                        started[child] = true;
+                        next.push_back(child);
+                    }
+                    if (head[child] < writers[child].size() && canStart(writers[child][head[child]])) {
+                        started[writers[child][head[child]]] = true;
+                        next.push_back(writers[child][head[child]]);
+                    }
+                }
+            }
+
+            // Continue with one of them on this thread, others go to the pool
+            for (size_t k = 0; k < next.size(); k++) {
+                if (k == 0)
+                    work.push_back(next[k]);
+                else
+                    pool.submit([&run, node = next[k]]() {run(node);});
+            }
+            // Nothing captured is used after the last node is done
+            remaining.fetch_sub(1, std::memory_order_release);
+        }
+    };
+
+    started[0] = true;
+    run(0);
+    pool.waitFor(remaining);
+    if (error != nullptr)
+        std::rethrow_exception(error);
+}
+
 void Tensor::resetGrad() {
+    wait();
     this->isGradInit = false;
-    this->grad = nullptr;
-    if (requiresGrad)
+    if (!requiresGrad) {
+        this->grad = nullptr;
+    } else if (this->grad == nullptr || this->grad->totalSize != this->totalSize) {
         this->grad = std::make_shared<Tensor>(shape, 0.0);
+    } else {
+        // Keep gradient storage between iterations, just zero it out
+        std::fill_n(this->grad->data.get(), this->grad->totalSize, 0.0);
+        this->grad->isGradInit = false;
+    }
     this->_backward = nullptr;
     this->operation = "";
     this->prev.clear();
 }
 
-const std::vector<size_t>& Tensor::getShape() const {
-    return this->shape;
+Tensor Tensor::replica() const {
+    if (this->pending != nullptr)
+        return resolved().replica();
+    Tensor result = *this;
+    result.grad = this->requiresGrad ? std::make_shared<Tensor>(this->shape, 0.0) : nullptr;
+    result.isGradInit = false;
+    result._backward = nullptr;
+    result.operation = "";
+    result.prev.clear();
+    return result;
+}
+
+Tensor Tensor::rowsView(size_t begin, size_t end) const {
+    if (this->pending != nullptr)
+        return resolved().rowsView(begin, end);
+    Tensor result = this->replica();
+    const size_t rowSize = this->strides[0];
+    result.shape[0] = end - begin;
+    result.initStrides();
+    // Aliasing pointer keeps the whole buffer alive
+    result.data = std::shared_ptr<double[]>(this->data, this->data.get() + begin * rowSize);
+    result.requiresGrad = false;
+    result.grad = nullptr;
+    return result;
+}
+
+const Shape& Tensor::getShape() const {
+    return resolved().shape;
+}
+
+Tensor& Tensor::wait() {
+    if (this->pending == nullptr)
+        return *this;
+
+    // Placeholder is only a handle, so it becomes a copy of the result. Every
+    // copy of the placeholder resolves itself the same way. Result is copied
+    // first, assignment releases the future.
+    const Tensor result = this->pending->get();
+    *this = result;
+    return *this;
+}
+
+const Tensor& Tensor::resolved() const {
+    return this->pending != nullptr ? this->pending->get() : *this;
 }
@@ -0,0 +1,349 @@
+#include "tensor.hpp"
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+/**
+ * Geometry of 2D convolution (or pooling) of one image
+ */
+struct ConvGeometry {
+    size_t channels, height, width;
+    size_t kernelHeight, kernelWidth;
+    size_t stride, padding;
+    size_t outHeight, outWidth;
+};
+
+/**
+ * Unfold part of the image into columns, one column for every output pixel
+ * in range [first, first + count). Rows of the tile are (channel, ky, kx).
+ * @param image Data of one CHW image
+ * @param g Geometry of the convolution
+ * @param first First output pixel of the tile
+ * @param count Number of output pixels in the tile
+ * @param col Output tile with shape [channels * kernelHeight * kernelWidth, count]
+ */
+void im2colTile(const double * image, const ConvGeometry& g, size_t first, size_t count,
+    double * col)
+{
+    size_t row = 0;
+    for (size_t c = 0; c < g.channels; c++) {
+        const double * plane = image + c * g.height * g.width;
+        for (size_t ky = 0; ky < g.kernelHeight; ky++) {
+            for (size_t kx = 0; kx < g.kernelWidth; kx++, row++) {
+                double * colRow = col + row * count;
+                for (size_t t = 0; t < count; t++) {
+                    const size_t oy = (first + t) / g.outWidth;
+                    const size_t ox = (first + t) % g.outWidth;
+                    // Padding is handled by unsigned overflow of negative indexes
+                    const size_t iy = oy * g.stride + ky - g.padding;
+                    const size_t ix = ox * g.stride + kx - g.padding;
+                    colRow[t] = iy < g.height && ix < g.width ? plane[iy * g.width + ix] : 0.0;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Fold gradient of the columns back to the image, reverse of im2colTile
+ */
+void col2imTile(const double * col, const ConvGeometry& g, size_t first, size_t count,
+    double * image)
+{
+    size_t row = 0;
+    for (size_t c = 0; c < g.channels; c++) {
+        double * plane = image + c * g.height * g.width;
+        for (size_t ky = 0; ky < g.kernelHeight; ky++) {
+            for (size_t kx = 0; kx < g.kernelWidth; kx++, row++) {
+                const double * colRow = col + row * count;
+                for (size_t t = 0; t < count; t++) {
+                    const size_t oy = (first + t) / g.outWidth;
+                    const size_t ox = (first + t) % g.outWidth;
+                    const size_t iy = oy * g.stride + ky - g.padding;
+                    const size_t ix = ox * g.stride + kx - g.padding;
+                    if (iy < g.height && ix < g.width)
+                        plane[iy * g.width + ix] += colRow[t];
+                }
+            }
+        }
+    }
+}
+
+// Most blocks of images with their own gradient of filters in backward
+const size_t MAX_GRAD_BLOCKS = 64;
+
+/**
+ * Number of output pixels in one im2col tile, so the tile stays in cache
+ */
+size_t convTileSize(const ConvGeometry& g) {
+    const size_t rows = g.channels * g.kernelHeight * g.kernelWidth;
+    return std::clamp<size_t>((1 << 15) / rows, 16, 512);
+}
+}
+
+Tensor Tensor::conv2d(Tensor& weight, size_t stride, size_t padding) {
+    return conv2d(weight, nullptr, stride, padding);
+}
+
+Tensor Tensor::conv2d(Tensor& weight, Tensor& bias, size_t stride, size_t padding) {
+    return conv2d(weight, &bias, stride, padding);
+}
+
+Tensor Tensor::conv2d(Tensor& weight, Tensor * bias, size_t stride, size_t padding) {
+    wait();
+    weight.wait();
+    if (bias != nullptr)
+        bias->wait();
+    if (this->shape.size() != 4 || weight.shape.size() != 4 || stride == 0
+        || weight.shape[1] != this->shape[1] || this->shape[1] == 0
+        || weight.shape[2] == 0 || weight.shape[3] == 0
+        || this->shape[2] + 2 * padding < weight.shape[2]
+        || this->shape[3] + 2 * padding < weight.shape[3]
+        || (bias != nullptr && bias->totalSize != weight.shape[0]))
+        return Tensor({0}, 0.0);
+
+    ConvGeometry g;
+    g.channels = this->shape[1];
+    g.height = this->shape[2];
+    g.width = this->shape[3];
+    g.kernelHeight = weight.shape[2];
+    g.kernelWidth = weight.shape[3];
+    g.stride = stride;
+    g.padding = padding;
+    g.outHeight = (g.height + 2 * padding - g.kernelHeight) / stride + 1;
+    g.outWidth = (g.width + 2 * padding - g.kernelWidth) / stride + 1;
+
+    const size_t images = this->shape[0];
+    const size_t outChannels = weight.shape[0];
+    const size_t pixels = g.outHeight * g.outWidth;
+    const size_t colRows = g.channels * g.kernelHeight * g.kernelWidth;
+    const size_t tile = convTileSize(g);
+    const size_t tiles = (pixels + tile - 1) / tile;
+
+    Shape resShape = {images, outChannels, g.outHeight, g.outWidth};
+    Tensor result(resShape, 0.0);
+    bool requiresGrad = this->requiresGrad || weight.requiresGrad
+        || (bias != nullptr && bias->requiresGrad);
+    if (requiresGrad) {
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {*this, weight};
+        if (bias != nullptr)
+            children.insert(*bias);
+        result = Tensor(resShape, 0.0, requiresGrad, operation, children);
+    }
+
+    // No images or filters, nothing to compute
+    if (result.totalSize == 0)
+        return result;
+
+    // Every (image, tile) pair writes its own part of the output. Unfolded
+    // tile is multiplied by filters [outChannels, colRows] straight into
+    // the output rows.
+    const double * in = this->data.get();
+    const double * w = weight.data.get();
+    const double * b = bias != nullptr ? bias->data.get() : nullptr;
+    double * out = result.data.get();
+    parallelFor(images * tiles, [=](size_t begin, size_t end) {
+        std::vector<double> col(colRows * tile);
+        for (size_t task = begin; task < end; task++) {
+            const size_t n = task / tiles;
+            const size_t first = (task % tiles) * tile;
+            const size_t count = std::min(tile, pixels - first);
+            im2colTile(in + n * g.channels * g.height * g.width, g, first, count, col.data());
+
+            for (size_t oc = 0; oc < outChannels; oc++) {
+                double * outRow = out + (n * outChannels + oc) * pixels + first;
+                if (b != nullptr)
+                    std::fill_n(outRow, count, b[oc]);
+                for (size_t r = 0; r < colRows; r++) {
+                    const double wr = w[oc * colRows + r];
+                    const double * colRow = col.data() + r * count;
+                    for (size_t t = 0; t < count; t++)
+                        outRow[t] += wr * colRow[t];
+                }
+            }
+        }
+    }, (1 << 15) / (outChannels * colRows * tile) + 1);
+
+    if (!requiresGrad)
+        return result;
+
+    // Define backward function for backpropagation
+    std::shared_ptr<double[]> inData = this->data, wData = weight.data;
+    std::shared_ptr<Tensor> inGrad = this->grad, wGrad = weight.grad, resGrad = result.grad;
+    std::shared_ptr<Tensor> bGrad = bias != nullptr ? bias->grad : nullptr;
+    result._backward = std::make_shared<std::function<void()>>(
+        [inData, wData, inGrad, wGrad, bGrad, resGrad, g, images, outChannels, pixels,
+            colRows, tile, tiles]() {
+            // Images are split into fixed blocks, every block accumulates
+            // gradient of filters in its own slot. Slots are summed in block
+            // order, so the result doesn't depend on number of threads.
+            const size_t wSize = wGrad != nullptr ? outChannels * colRows : 0;
+            const size_t bSize = bGrad != nullptr ? outChannels : 0;
+            const size_t blockImages = std::max((1 << 15) / (outChannels * colRows * pixels) + 1,
+                (images + MAX_GRAD_BLOCKS - 1) / MAX_GRAD_BLOCKS);
+            const size_t blocks = (images + blockImages - 1) / blockImages;
+            std::vector<double> partial(blocks * (wSize + bSize), 0.0);
+            parallelFor(blocks, [&](size_t begin, size_t end) {
+                std::vector<double> col(colRows * tile), colGrad(colRows * tile);
+                for (size_t block = begin; block < end; block++) {
+                    double * wGradLocal = partial.data() + block * (wSize + bSize);
+                    double * bGradLocal = wGradLocal + wSize;
+                    const size_t last = std::min(images, (block + 1) * blockImages);
+                    for (size_t n = block * blockImages; n < last; n++) {
+                        const double * image = inData.get() + n * g.channels * g.height * g.width;
+                        for (size_t tileIndex = 0; tileIndex < tiles; tileIndex++) {
+                            const size_t first = tileIndex * tile;
+                            const size_t count = std::min(tile, pixels - first);
+                            if (wGrad != nullptr)
+                                im2colTile(image, g, first, count, col.data());
+                            if (inGrad != nullptr)
+                                std::fill_n(colGrad.begin(), colRows * count, 0.0);
+
+                            for (size_t oc = 0; oc < outChannels; oc++) {
+                                const double * gRow = resGrad->data.get()
+                                    + (n * outChannels + oc) * pixels + first;
+                                for (size_t r = 0; r < colRows; r++) {
+                                    // dW = dOut * col^T
+                                    if (wGrad != nullptr)
+                                        wGradLocal[oc * colRows + r] +=
+                                            dotKernel(gRow, col.data() + r * count, count);
+                                    // dCol = W^T * dOut
+                                    if (inGrad != nullptr) {
+                                        const double wr = wData[oc * colRows + r];
+                                        double * colGradRow = colGrad.data() + r * count;
+                                        for (size_t t = 0; t < count; t++)
+                                            colGradRow[t] += wr * gRow[t];
+                                    }
+                                }
+                                if (bGrad != nullptr)
+                                    for (size_t t = 0; t < count; t++)
+                                        bGradLocal[oc] += gRow[t];
+                            }
+
+                            if (inGrad != nullptr)
+                                col2imTile(colGrad.data(), g, first, count,
+                                    inGrad->data.get() + n * g.channels * g.height * g.width);
+                        }
+                    }
+                }
+            }, 1);
+
+            for (size_t block = 0; block < blocks; block++) {
+                const double * slot = partial.data() + block * (wSize + bSize);
+                for (size_t i = 0; i < wSize; i++)
+                    wGrad->data[i] += slot[i];
+                for (size_t i = 0; i < bSize; i++)
+                    bGrad->data[i] += slot[wSize + i];
+            }
+
+            if (inGrad != nullptr)
+                inGrad->isGradInit = true;
+            if (wGrad != nullptr)
+                wGrad->isGradInit = true;
+            if (bGrad != nullptr)
+                bGrad->isGradInit = true;
+        });
+
+    return result;
+}
+
+Tensor Tensor::maxPool2d(size_t kernel, size_t stride) {
+    return pool2d(kernel, stride, true);
+}
+
+Tensor Tensor::avgPool2d(size_t kernel, size_t stride) {
+    return pool2d(kernel, stride, false);
+}
+
+Tensor Tensor::pool2d(size_t kernel, size_t stride, bool isMax) {
+    wait();
+    if (this->shape.size() != 4 || kernel == 0 || stride == 0
+        || this->shape[2] < kernel || this->shape[3] < kernel)
+        return Tensor({0}, 0.0);
+
+    const size_t planes = this->shape[0] * this->shape[1];
+    const size_t height = this->shape[2];
+    const size_t width = this->shape[3];
+    const size_t outHeight = (height - kernel) / stride + 1;
+    const size_t outWidth = (width - kernel) / stride + 1;
+
+    Shape resShape = {this->shape[0], this->shape[1], outHeight, outWidth};
+    Tensor result(resShape, 0.0);
+    bool requiresGrad = this->requiresGrad;
+    if (requiresGrad) {
+        std::unordered_set<Tensor, HashFunction, EqualFunction> children = {*this};
+        result = Tensor(resShape, 0.0, requiresGrad, operation, children);
+    }
+
+    // Indexes of max values inside of the plane, they are needed for backward
+    auto indexes = std::make_shared<std::vector<size_t>>(isMax ? result.totalSize : 0);
+    const double * in = this->data.get();
+    double * out = result.data.get();
+    const double area = (double) (kernel * kernel);
+    parallelFor(planes, [&](size_t begin, size_t end) {
+        for (size_t p = begin; p < end; p++) {
+            const double * plane = in + p * height * width;
+            for (size_t oy = 0; oy < outHeight; oy++) {
+                for (size_t ox = 0; ox < outWidth; ox++) {
+                    const size_t outIndex = (p * outHeight + oy) * outWidth + ox;
+                    const size_t corner = oy * stride * width + ox * stride;
+
+                    if (!isMax) {
+                        double sum = 0.0;
+                        for (size_t ky = 0; ky < kernel; ky++)
+                            for (size_t kx = 0; kx < kernel; kx++)
+                                sum += plane[corner + ky * width + kx];
+                        out[outIndex] = sum / area;
+                        continue;
+                    }
+
+                    size_t best = corner;
+                    for (size_t ky = 0; ky < kernel; ky++)
+                        for (size_t kx = 0; kx < kernel; kx++)
+                            if (plane[corner + ky * width + kx] > plane[best])
+                                best = corner + ky * width + kx;
+                    out[outIndex] = plane[best];
+                    (*indexes)[outIndex] = best;
+                }
+            }
+        }
+    }, (1 << 15) / (height * width) + 1);
+
+    if (!requiresGrad)
+        return result;
+
+    // Define backward function for backpropagation
+    std::shared_ptr<Tensor> inGrad = this->grad, resGrad = result.grad;
+    result._backward = std::make_shared<std::function<void()>>(
+        [inGrad, resGrad, indexes, isMax, planes, height, width, outHeight, outWidth,
+            kernel, stride, area]() {
+            parallelFor(planes, [&](size_t begin, size_t end) {
+                for (size_t p = begin; p < end; p++) {
+                    double * plane = inGrad->data.get() + p * height * width;
+                    for (size_t oy = 0; oy < outHeight; oy++) {
+                        for (size_t ox = 0; ox < outWidth; ox++) {
+                            const size_t outIndex = (p * outHeight + oy) * outWidth + ox;
+                            const double g = resGrad->data[outIndex];
+
+                            // Only max element gets gradient update
+                            if (isMax) {
+                                plane[(*indexes)[outIndex]] += g;
+                                continue;
+                            }
+
+                            const size_t corner = oy * stride * width + ox * stride;
+                            for (size_t ky = 0; ky < kernel; ky++)
+                                for (size_t kx = 0; kx < kernel; kx++)
+                                    plane[corner + ky * width + kx] += g / area;
+                        }
+                    }
+                }
+            }, (1 << 15) / (height * width) + 1);
+            inGrad->isGradInit = true;
+        });
+
+    return result;
+}
@@ -0,0 +1,148 @@
+#include "tensor.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+// Values of memory policies from linux/mempolicy.h
+const int MPOL_BIND_MODE = 2;
+const int MPOL_INTERLEAVE_MODE = 3;
+
+// Smaller buffers come from the heap, policy is not worth a system call
+const size_t MAPPED_BYTES = 1 << 20;
+
+// Heap buffers start at cache line, so SIMD loads are not split
+const size_t ALIGNMENT = 64;
+const size_t HUGE_PAGE_BYTES = 2 << 20;
+
+/**
+ * Map anonymous memory starting at huge page boundary, so kernel can back
+ * all of it by huge pages
+ * @param bytes Size of the mapping, multiple of huge page
+ * @return Start of the mapping or MAP_FAILED
+ */
+void * mapHugeAligned(size_t bytes) {
+    char * memory = (char *) mmap(nullptr, bytes + HUGE_PAGE_BYTES, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return MAP_FAILED;
+
+    // Unmap parts before and after the aligned range
+    const size_t head = (HUGE_PAGE_BYTES - (uintptr_t) memory % HUGE_PAGE_BYTES) % HUGE_PAGE_BYTES;
+    if (head > 0)
+        munmap(memory, head);
+    munmap(memory + head + bytes, HUGE_PAGE_BYTES - head);
+    return memory + head;
+}
+
+/**
+ * Read online NUMA nodes from sysfs, list looks like "0-1,3"
+ * @return Indexes of online nodes, empty if system has no NUMA
+ */
+std::vector<unsigned> onlineNodes() {
+    std::vector<unsigned> nodes;
+    std::ifstream file("/sys/devices/system/node/online");
+    std::string range;
+    while (std::getline(file, range, ',')) {
+        const size_t dash = range.find('-');
+        const unsigned first = std::stoul(range.substr(0, dash));
+        const unsigned last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+        for (unsigned node = first; node <= last; node++)
+            nodes.push_back(node);
+    }
+    return nodes;
+}
+
+/**
+ * Online nodes are read once, they don't change while the process runs
+ * @return Indexes of online nodes, empty if system has no NUMA
+ */
+const std::vector<unsigned>& numaNodes() {
+    static const std::vector<unsigned> nodes = onlineNodes();
+    return nodes;
+}
+
+/**
+ * Set memory policy of mapped range
+ * @param memory Start of the range
+ * @param bytes Size of the range
+ * @param mode Memory policy mode
+ * @param nodes Nodes allowed by the policy
+ * @return false if kernel refused the policy, errno is set then
+ */
+bool bindMemory(void * memory, size_t bytes, int mode, const std::vector<unsigned>& nodes) {
+    uint64_t mask[16] = {};
+    for (unsigned node : nodes)
+        if (node < 64 * 16)
+            mask[node / 64] |= uint64_t(1) << (node % 64);
+    return syscall(SYS_mbind, memory, bytes, mode, mask, 64 * 16 + 1, 0) == 0;
+}
+}
+
+void Tensor::setMemoryPolicy(MemoryPolicy policy, unsigned node) {
+    const std::vector<unsigned>& nodes = numaNodes();
+    if (policy == MemoryPolicy::Bind && !nodes.empty()
+        && std::find(nodes.begin(), nodes.end(), node) == nodes.end())
+        throw std::invalid_argument("Memory node " + std::to_string(node) + " is not online");
+    memoryPolicy = policy;
+    memoryNode = node;
+}
+
+void Tensor::setHugePages(HugePages mode) {
+    hugePages = mode;
+}
+
+std::shared_ptr<double[]> Tensor::allocate(size_t size) {
+    const size_t bytes = std::max<size_t>(1, size) * sizeof(double);
+    if (bytes < MAPPED_BYTES) {
+        double * memory = (double *) ::operator new[](bytes, std::align_val_t(ALIGNMENT));
+        return std::shared_ptr<double[]>(memory, [](double * data) {
+            ::operator delete[](data, std::align_val_t(ALIGNMENT));
+        });
+    }
+
+    // Pages of the mapping are placed when they are touched for first time
+    void * memory = MAP_FAILED;
+    size_t mapped = bytes;
+    if (hugePages != HugePages::None) {
+        mapped = (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+        if (hugePages == HugePages::Explicit)
+            memory = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory == MAP_FAILED) {
+            memory = mapHugeAligned(mapped);
+            if (memory != MAP_FAILED)
+                madvise(memory, mapped, MADV_HUGEPAGE);
+        }
+    } else {
+        memory = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (memory == MAP_FAILED)
+        throw std::bad_alloc();
+
+    const std::vector<unsigned>& nodes = numaNodes();
+    bool bound = true;
+    if (nodes.size() > 1 && memoryPolicy == MemoryPolicy::Interleave)
+        bound = bindMemory(memory, mapped, MPOL_INTERLEAVE_MODE, nodes);
+    else if (nodes.size() > 1 && memoryPolicy == MemoryPolicy::Bind)
+        bound = bindMemory(memory, mapped, MPOL_BIND_MODE, {memoryNode});
+    if (!bound) {
+        const int error = errno;
+        munmap(memory, mapped);
+        throw std::runtime_error(std::string("mbind failed: ") + std::strerror(error));
+    }
+
+    return std::shared_ptr<double[]>((double *) memory, [mapped](double * data) {
+        munmap(data, mapped);
+    });
+}
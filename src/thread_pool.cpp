@@ -0,0 +1,167 @@
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <sched.h>
+
+ThreadPool::ThreadPool(size_t threadCount)
+    :queued(0), stop(false)
+{
+    for (size_t i = 0; i <= threadCount; i++)
+        this->queues.push_back(std::make_unique<Queue>());
+    for (size_t i = 0; i < threadCount; i++)
+        this->threads.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->sleepMutex);
+        this->stop = true;
+    }
+    this->wakeUp.notify_all();
+    for (std::thread& thread : this->threads)
+        thread.join();
+}
+
+ThreadPool& ThreadPool::global() {
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+void ThreadPool::submit(Task task) {
+    submit(std::move(task), ownQueue());
+}
+
+void ThreadPool::submit(Task task, size_t index) {
+    Queue& queue = *this->queues[index];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    this->queued++;
+
+    // Sleeping worker checks counter under the lock, so wake up is not lost
+    { std::lock_guard<std::mutex> lock(this->sleepMutex); }
+    this->wakeUp.notify_one();
+}
+
+void ThreadPool::waitFor(const std::atomic<size_t>& pending) {
+    const size_t index = ownQueue();
+    while (pending.load(std::memory_order_acquire) != 0) {
+        if (!runTask(index))
+            std::this_thread::yield();
+    }
+}
+
+void ThreadPool::parallelFor(size_t size, const std::function<void(size_t, size_t)>& func,
+    size_t grain)
+{
+    // Few chunks per thread, so threads that finish early can steal the rest
+    grain = std::max<size_t>(1, grain);
+    const size_t chunks = std::min(size / grain, 4 * (this->threads.size() + 1));
+    if (chunks <= 1 || this->threads.empty()) {
+        func(0, size);
+        return;
+    }
+
+    // Chunks keep references to this frame, so it waits for all of them
+    // even if one throws, the first exception is rethrown then
+    std::atomic<size_t> pending = chunks - 1;
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    auto runChunk = [&](size_t c) {
+        try {
+            func(size * c / chunks, size * (c + 1) / chunks);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (error == nullptr)
+                error = std::current_exception();
+        }
+    };
+
+    for (size_t c = 1; c < chunks; c++) {
+        submit([&, c]() {
+            runChunk(c);
+            pending.fetch_sub(1, std::memory_order_release);
+        }, (c - 1) % this->threads.size());
+    }
+    runChunk(0);
+    waitFor(pending);
+    if (error != nullptr)
+        std::rethrow_exception(error);
+}
+
+bool ThreadPool::pinThreads() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return false;
+    std::vector<int> cores;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &allowed))
+            cores.push_back(cpu);
+
+    // Workers start from the second allowed core, the calling thread itself
+    // is not pinned. First core gets a worker only if there are more workers
+    // than cores.
+    bool pinned = true;
+    for (size_t i = 0; i < this->threads.size(); i++) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cores[(i + 1) % cores.size()], &set);
+        pinned &= pthread_setaffinity_np(this->threads[i].native_handle(), sizeof(set), &set) == 0;
+    }
+    return pinned;
+}
+
+size_t ThreadPool::getThreadCount() const {
+    return this->threads.size();
+}
+
+void ThreadPool::workerLoop(size_t index) {
+    current = this;
+    currentIndex = index;
+    while (true) {
+        if (runTask(index))
+            continue;
+
+        std::unique_lock<std::mutex> lock(this->sleepMutex);
+        this->wakeUp.wait(lock, [&]() {return this->stop || this->queued > 0;});
+        if (this->stop && this->queued == 0)
+            return;
+    }
+}
+
+bool ThreadPool::runTask(size_t index) {
+    Task task;
+
+    // Own queue from the back, others from the front
+    for (size_t i = 0; i < this->queues.size() && !task; i++) {
+        Queue& queue = *this->queues[(index + i) % this->queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+            continue;
+        if (i == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        } else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+    }
+    if (!task)
+        return false;
+
+    this->queued--;
+    task();
+    return true;
+}
+
+size_t ThreadPool::ownQueue() const {
+    return current == this ? currentIndex : this->queues.size() - 1;
+}
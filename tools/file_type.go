@@ -5,6 +5,7 @@ import (
 	"errors"
 	"fmt"
 	"os"
+	"path/filepath"
 	"regexp"
 	"strings"
 )
@@ -18,57 +19,64 @@ const (
 )
 
 type FileInfo struct {
-	Path    string
-	Type    FileType
-	Content string
+	Path     string
+	Type     FileType
+	Content  string
+	Includes []string // Names of local files included by this file
 }
 
 var (
-	includeRe = regexp.MustCompile(`#include\s+".*".*$`)
+	includeRe = regexp.MustCompile(`#include\s+"(.*)".*$`)
 )
 
 func NewFileType(path string) (*FileInfo, error) {
 	fileType := getFileType(path)
-	content, err := getFileFilteredCotent(path, fileType)
+	content, includes, err := getFileFilteredCotent(path, fileType)
 	if err != nil || content == nil {
 		return nil, err
 	}
 
 	return &FileInfo{
-		Path:    path,
-		Type:    fileType,
-		Content: *content,
+		Path:     path,
+		Type:     fileType,
+		Content:  *content,
+		Includes: includes,
 	}, nil
 }
 
-func getFileFilteredCotent(path string, fileType FileType) (*string, error) {
+func getFileFilteredCotent(path string, fileType FileType) (*string, []string, error) {
 	// Read file content
 	content, err := os.ReadFile(path)
 	if err != nil {
 		fmt.Println("Error reading file:", err)
-		return nil, errors.New("Couldn't read file: " + path)
+		return nil, nil, errors.New("Couldn't read file: " + path)
 	}
 	contentStr := string(content)
 
-	// Filter out includes from source files
-	if fileType == Source {
-		return removeIncludes(&contentStr), nil
+	// Filter out local includes from source and header files, all of them
+	// end up in the same file
+	if fileType == Source || fileType == Header {
+		filtered, includes := removeIncludes(&contentStr)
+		return filtered, includes, nil
 	}
 
-	return &contentStr, nil
+	return &contentStr, nil, nil
 }
 
-func removeIncludes(content *string) *string {
+func removeIncludes(content *string) (*string, []string) {
 	if content == nil {
 		panic("File content is nil")
 	}
 
 	var builder strings.Builder
+	includes := []string{}
 	scanner := bufio.NewScanner(strings.NewReader(*content))
 
 	for scanner.Scan() {
 		line := scanner.Text()
-		if !includeRe.MatchString(line) {
+		if match := includeRe.FindStringSubmatch(line); match != nil {
+			includes = append(includes, filepath.Base(match[1]))
+		} else {
 			builder.WriteString(line)
 			builder.WriteByte('\n') // Add new line to the string
 		}
@@ -76,7 +84,7 @@ func removeIncludes(content *string) *string {
 
 	result := strings.TrimSuffix(builder.String(), "\n")
 
-	return &result
+	return &result, includes
 }
 
 func getFileType(path string) FileType {
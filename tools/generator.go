@@ -43,16 +43,25 @@ func makeSingleHeader(root string, des string, defineImplPrefix string) (string,
 	// So they're in correct format
 	headersText := ""
 	sourcesText := ""
+	headers := []FileInfo{}
 	for _, file := range *files {
+		// Separate files by new line, so last line of one file and first
+		// line of the next file don't end up on the same line
 		if file.Type == Source {
-			sourcesText += file.Content
+			sourcesText += file.Content + "\n"
 		} else if file.Type == Header {
-			headersText += file.Content
+			headers = append(headers, file)
 		} else if file.Type == Unsopported {
 			fmt.Printf("Unsupported file (%s)\n", file.Path)
 		}
 	}
 
+	// Local includes were removed from headers, so every header has to be
+	// placed after headers it depends on
+	for _, header := range sortHeaders(headers) {
+		headersText += header.Content + "\n"
+	}
+
 	desFile, err := os.OpenFile(des, os.O_CREATE|os.O_WRONLY|os.O_TRUNC, 0644)
 	if err != nil {
 		fmt.Println("Cannot open destination file: " + des)
@@ -84,6 +93,38 @@ func makeSingleHeader(root string, des string, defineImplPrefix string) (string,
 	return "", nil
 }
 
+// Order headers so every header comes after all headers it includes
+func sortHeaders(headers []FileInfo) []FileInfo {
+	byName := map[string]FileInfo{}
+	for _, header := range headers {
+		byName[filepath.Base(header.Path)] = header
+	}
+
+	sorted := []FileInfo{}
+	visited := map[string]bool{}
+	var visit func(header FileInfo)
+	visit = func(header FileInfo) {
+		name := filepath.Base(header.Path)
+		if visited[name] {
+			return
+		}
+		visited[name] = true
+
+		for _, include := range header.Includes {
+			if dependency, ok := byName[include]; ok {
+				visit(dependency)
+			}
+		}
+		sorted = append(sorted, header)
+	}
+
+	for _, header := range headers {
+		visit(header)
+	}
+
+	return sorted
+}
+
 func getAllFilesInfo(folders *[]string) (*[]FileInfo, error) {
 	fileTypes := []FileInfo{}
 